@@ -0,0 +1,334 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "world/quad_tree.h"
+#include "world/quad_tree_snapshot.h"
+
+/*
+ * Headless QuadTree benchmarks.
+ *
+ * Each benchmark runs on seeded workloads (uniform, clustered and elongated
+ * objects) of increasing sizes, for both tight and loose trees. Timings are
+ * written to stdout as JSON so that runs can be compared between changes.
+ *
+ * Usage: quad_tree_bench [--seed N] [--repetitions N] [--max-size N] [--queries N]
+ */
+
+static constexpr QuadTreeRegion WORLD_REGION{ 0, 0, 10000, 10000 };
+
+struct BenchObject {
+  QuadTreeRegion region;
+};
+
+struct BenchObjectRegionMapper {
+  QuadTreeRegion operator()(const BenchObject *object) const { return object->region; }
+};
+
+using TightTree = QuadTree<const BenchObject *, BenchObjectRegionMapper>;
+using LooseTree = LooseQuadTree<const BenchObject *, BenchObjectRegionMapper>;
+using CostTree = QuadTree<const BenchObject *, BenchObjectRegionMapper, 1.f, QuadTreeCostPolicy>;
+
+// number of overlapping searches done at once by the collectBatch benchmark
+static constexpr size_t VIEWS_PER_BATCH = 4;
+
+struct BenchOptions {
+  unsigned int seed = 42;
+  size_t repetitions = 5;
+  size_t maxSize = 1'000'000;
+  size_t queriesCount = 1000;
+};
+
+/* A custom (non-rectangular) search, the objects overlapping a disk */
+struct DiskSearch {
+  QuadTreePoint center;
+  float radius;
+
+  std::pair<bool, bool> operator()(const QuadTreeRegion &region) const
+  {
+    float farX = std::max(std::abs(region.minX - center.x), std::abs(region.maxX - center.x));
+    float farY = std::max(std::abs(region.minY - center.y), std::abs(region.maxY - center.y));
+    bool contains = farX*farX + farY*farY <= radius*radius;
+    return { contains, contains || region.distanceSquared(center) <= radius*radius };
+  }
+};
+
+static QuadTreeRegion makeRegion(float centerX, float centerY, float width, float height)
+{
+  centerX = std::clamp(centerX, WORLD_REGION.minX, WORLD_REGION.maxX);
+  centerY = std::clamp(centerY, WORLD_REGION.minY, WORLD_REGION.maxY);
+  return { centerX - width*.5f, centerY - height*.5f, centerX + width*.5f, centerY + height*.5f };
+}
+
+static std::vector<BenchObject> generateUniform(std::mt19937 &rng, size_t count)
+{
+  std::uniform_real_distribution<float> position(WORLD_REGION.minX, WORLD_REGION.maxX);
+  std::uniform_real_distribution<float> size(.5f, 10.f);
+  std::vector<BenchObject> objects(count);
+  for (BenchObject &object : objects)
+    object.region = makeRegion(position(rng), position(rng), size(rng), size(rng));
+  return objects;
+}
+
+// objects gathered around a few points, like props in a level
+static std::vector<BenchObject> generateClustered(std::mt19937 &rng, size_t count)
+{
+  constexpr size_t CLUSTERS_COUNT = 32;
+  std::uniform_real_distribution<float> position(WORLD_REGION.minX, WORLD_REGION.maxX);
+  std::uniform_real_distribution<float> spread(20.f, 300.f);
+  std::uniform_real_distribution<float> size(.5f, 10.f);
+  std::vector<std::pair<std::normal_distribution<float>, std::normal_distribution<float>>> clusters;
+  for (size_t i = 0; i < CLUSTERS_COUNT; i++) {
+    float s = spread(rng);
+    clusters.emplace_back(std::normal_distribution<float>(position(rng), s), std::normal_distribution<float>(position(rng), s));
+  }
+  std::uniform_int_distribution<size_t> cluster(0, CLUSTERS_COUNT-1);
+  std::vector<BenchObject> objects(count);
+  for (BenchObject &object : objects) {
+    auto &[x, y] = clusters[cluster(rng)];
+    object.region = makeRegion(x(rng), y(rng), size(rng), size(rng));
+  }
+  return objects;
+}
+
+// long and thin objects, like track pieces or walls, that tend to cross cell midlines
+static std::vector<BenchObject> generateElongated(std::mt19937 &rng, size_t count)
+{
+  std::uniform_real_distribution<float> position(WORLD_REGION.minX, WORLD_REGION.maxX);
+  std::uniform_real_distribution<float> length(50.f, 800.f);
+  std::uniform_real_distribution<float> thickness(.5f, 4.f);
+  std::bernoulli_distribution horizontal;
+  std::vector<BenchObject> objects(count);
+  for (BenchObject &object : objects) {
+    float l = length(rng), t = thickness(rng);
+    object.region = horizontal(rng)
+      ? makeRegion(position(rng), position(rng), l, t)
+      : makeRegion(position(rng), position(rng), t, l);
+  }
+  return objects;
+}
+
+struct Workload {
+  const char *name;
+  std::vector<BenchObject> (*generate)(std::mt19937 &, size_t);
+};
+
+static constexpr Workload WORKLOADS[] = {
+  { "uniform",   generateUniform },
+  { "clustered", generateClustered },
+  { "elongated", generateElongated },
+};
+
+class JsonReport {
+public:
+  JsonReport(const BenchOptions &options)
+  {
+    std::printf("{\n  \"seed\": %u,\n  \"repetitions\": %zu,\n  \"queries\": %zu,\n  \"results\": [", options.seed, options.repetitions, options.queriesCount);
+  }
+
+  ~JsonReport()
+  {
+    std::printf("\n  ]\n}\n");
+  }
+
+  // timings are in milliseconds, checksum is a benchmark-specific value (usually the number of found objects)
+  void addResult(const char *tree, const char *workload, size_t size, const char *benchmark, std::vector<double> timings, size_t checksum)
+  {
+    std::sort(timings.begin(), timings.end());
+    double median = timings[timings.size()/2];
+    std::printf("%s\n    { \"tree\": \"%s\", \"workload\": \"%s\", \"size\": %zu, \"benchmark\": \"%s\", \"min_ms\": %.4f, \"median_ms\": %.4f, \"max_ms\": %.4f, \"checksum\": %zu }",
+      m_firstResult ? "" : ",", tree, workload, size, benchmark, timings.front(), median, timings.back(), checksum);
+    std::fflush(stdout);
+    m_firstResult = false;
+  }
+
+private:
+  bool m_firstResult = true;
+};
+
+static double measure(const std::function<void()> &func)
+{
+  auto begin = std::chrono::steady_clock::now();
+  func();
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::milli>(end - begin).count();
+}
+
+template<class Tree>
+struct SnapshotBufferOf;
+template<class T, class TRegionMapper, float Looseness, class Policy>
+struct SnapshotBufferOf<QuadTree<T, TRegionMapper, Looseness, Policy>> { using type = QuadTreeSnapshotBuffer<T, TRegionMapper, Looseness, Policy>; };
+
+template<class Tree>
+static void runTreeBenchmarks(JsonReport &report, const char *treeName, const char *workloadName, const std::vector<BenchObject> &objects, const BenchOptions &options)
+{
+  std::vector<const BenchObject *> values(objects.size());
+  std::ranges::transform(objects, values.begin(), [](const BenchObject &object) { return &object; });
+
+  // queries are generated from their own seed so that they do not depend on the workload size
+  std::mt19937 queriesRng(options.seed + 1);
+  std::uniform_real_distribution<float> position(WORLD_REGION.minX, WORLD_REGION.maxX);
+  std::uniform_real_distribution<float> extent(10.f, 500.f);
+  std::vector<QuadTreeRegion> boundsQueries(options.queriesCount);
+  std::vector<DiskSearch> diskQueries(options.queriesCount);
+  for (size_t i = 0; i < options.queriesCount; i++) {
+    boundsQueries[i] = makeRegion(position(queriesRng), position(queriesRng), extent(queriesRng), extent(queriesRng));
+    diskQueries[i] = DiskSearch{ { position(queriesRng), position(queriesRng) }, extent(queriesRng) };
+  }
+  std::uniform_real_distribution<float> viewOffset(-50.f, 50.f);
+  std::vector<DiskSearch> viewQueries;
+  for (size_t i = 0; i < options.queriesCount / VIEWS_PER_BATCH * VIEWS_PER_BATCH; i += VIEWS_PER_BATCH) {
+    QuadTreePoint center{ position(queriesRng), position(queriesRng) };
+    float radius = extent(queriesRng);
+    for (size_t v = 0; v < VIEWS_PER_BATCH; v++)
+      viewQueries.push_back(DiskSearch{ { center.x + viewOffset(queriesRng), center.y + viewOffset(queriesRng) }, radius });
+  }
+
+  Tree tree{ WORLD_REGION };
+  std::vector<double> timings;
+  size_t checksum = 0;
+
+  timings.clear();
+  for (size_t r = 0; r < options.repetitions; r++) {
+    tree.clear();
+    timings.push_back(measure([&] { for (const BenchObject *value : values) tree.add(value); }));
+  }
+  report.addResult(treeName, workloadName, objects.size(), "add", timings, tree.size());
+
+  timings.clear();
+  for (size_t r = 0; r < options.repetitions; r++)
+    timings.push_back(measure([&] { tree.build(values); }));
+  report.addResult(treeName, workloadName, objects.size(), "build", timings, tree.size());
+
+  timings.clear();
+  for (size_t r = 0; r < options.repetitions; r++) {
+    tree.build(values);
+    timings.push_back(measure([&] { tree.clear(); }));
+  }
+  report.addResult(treeName, workloadName, objects.size(), "clear", timings, tree.size());
+
+  tree.build(values);
+  std::vector<const BenchObject *> collected;
+  timings.clear();
+  for (size_t r = 0; r < options.repetitions; r++) {
+    checksum = 0;
+    timings.push_back(measure([&] {
+      for (const QuadTreeRegion &query : boundsQueries) {
+        collected.clear();
+        tree.collectInBounds(collected, query);
+        checksum += collected.size();
+      }
+    }));
+  }
+  report.addResult(treeName, workloadName, objects.size(), "collectInBounds", timings, checksum);
+
+  timings.clear();
+  for (size_t r = 0; r < options.repetitions; r++) {
+    checksum = 0;
+    timings.push_back(measure([&] {
+      for (const DiskSearch &query : diskQueries) {
+        collected.clear();
+        tree.template collectMapInShape<const BenchObject *>(collected, query);
+        checksum += collected.size();
+      }
+    }));
+  }
+  report.addResult(treeName, workloadName, objects.size(), "collectInShape", timings, checksum);
+
+  timings.clear();
+  for (size_t r = 0; r < options.repetitions; r++) {
+    checksum = 0;
+    timings.push_back(measure([&] {
+      for (const DiskSearch &query : diskQueries)
+        tree.forEachInShape(query, [&](const BenchObject *) { checksum++; });
+    }));
+  }
+  report.addResult(treeName, workloadName, objects.size(), "forEachInShape", timings, checksum);
+
+  // overlapping searches, like the views of several cameras, searched one by one then by batches sharing their traversals
+  std::vector<std::vector<const BenchObject *>> viewsCollected(VIEWS_PER_BATCH);
+  timings.clear();
+  for (size_t r = 0; r < options.repetitions; r++) {
+    checksum = 0;
+    timings.push_back(measure([&] {
+      for (const DiskSearch &query : viewQueries) {
+        collected.clear();
+        tree.template collectMapInShape<const BenchObject *>(collected, query);
+        checksum += collected.size();
+      }
+    }));
+  }
+  report.addResult(treeName, workloadName, objects.size(), "collectViews", timings, checksum);
+
+  timings.clear();
+  for (size_t r = 0; r < options.repetitions; r++) {
+    checksum = 0;
+    timings.push_back(measure([&] {
+      for (size_t first = 0; first < viewQueries.size(); first += VIEWS_PER_BATCH) {
+        for (auto &viewCollected : viewsCollected)
+          viewCollected.clear();
+        tree.collectBatch(std::span(viewQueries).subspan(first, VIEWS_PER_BATCH), viewsCollected);
+        for (auto &viewCollected : viewsCollected)
+          checksum += viewCollected.size();
+      }
+    }));
+  }
+  report.addResult(treeName, workloadName, objects.size(), "collectBatchViews", timings, checksum);
+
+  typename SnapshotBufferOf<Tree>::type snapshots;
+  timings.clear();
+  for (size_t r = 0; r < options.repetitions; r++)
+    timings.push_back(measure([&] { snapshots.publish(tree); }));
+  report.addResult(treeName, workloadName, objects.size(), "publishSnapshot", timings, snapshots.acquire()->size());
+}
+
+static BenchOptions parseOptions(int argc, char **argv)
+{
+  BenchOptions options;
+  for (int i = 1; i < argc; i++) {
+    auto readValue = [&]() -> unsigned long long {
+      if (i+1 >= argc) {
+        std::fprintf(stderr, "Missing value for %s\n", argv[i]);
+        std::exit(1);
+      }
+      return std::strtoull(argv[++i], nullptr, 10);
+    };
+    if (std::strcmp(argv[i], "--seed") == 0) {
+      options.seed = static_cast<unsigned int>(readValue());
+    } else if (std::strcmp(argv[i], "--repetitions") == 0) {
+      options.repetitions = std::max<size_t>(1, readValue());
+    } else if (std::strcmp(argv[i], "--max-size") == 0) {
+      options.maxSize = readValue();
+    } else if (std::strcmp(argv[i], "--queries") == 0) {
+      options.queriesCount = readValue();
+    } else {
+      std::fprintf(stderr, "Usage: %s [--seed N] [--repetitions N] [--max-size N] [--queries N]\n", argv[0]);
+      std::exit(1);
+    }
+  }
+  return options;
+}
+
+int main(int argc, char **argv)
+{
+  BenchOptions options = parseOptions(argc, argv);
+  JsonReport report(options);
+  for (size_t size = 1'000; size <= options.maxSize; size *= 10) {
+    for (const Workload &workload : WORKLOADS) {
+      std::mt19937 rng(options.seed);
+      std::vector<BenchObject> objects = workload.generate(rng, size);
+      runTreeBenchmarks<TightTree>(report, "tight", workload.name, objects, options);
+      runTreeBenchmarks<LooseTree>(report, "loose", workload.name, objects, options);
+      runTreeBenchmarks<CostTree>(report, "cost", workload.name, objects, options);
+    }
+  }
+  return 0;
+}
@@ -1,5 +1,7 @@
 #include "camera.h"
 
+#include "world/quad_tree.h"
+
 using namespace DirectX;
 
 namespace pbl
@@ -133,6 +135,17 @@ bool Frustum::isOnFrustum(const AABB &boudingBox) const
     true;
 }
 
+bool Frustum::isFullyInFrustum(const AABB &boundingBox) const
+{
+  return
+    isFullyForwardPlan(leftFace,   boundingBox) &&
+    isFullyForwardPlan(rightFace,  boundingBox) &&
+    isFullyForwardPlan(topFace,    boundingBox) &&
+    isFullyForwardPlan(bottomFace, boundingBox) &&
+    isFullyForwardPlan(nearFace,   boundingBox) &&
+    isFullyForwardPlan(farFace,    boundingBox);
+}
+
 Frustum Frustum::createFrustumFromCamera(const Camera& cam)
 {
   return std::visit([&](const auto &proj) { return createFrustumFromProjection(cam, proj); }, cam.getProjection());
@@ -147,4 +160,21 @@ bool Frustum::isOnOrForwardPlan(const Plane &plane, const AABB &boundingBox)
   return -r <= plane.signedDistanceTo(center);
 }
 
+bool Frustum::isFullyForwardPlan(const Plane &plane, const AABB &boundingBox)
+{
+  vec3 center = boundingBox.getOrigin() + boundingBox.getSize() / 2.f;
+  vec3 e = boundingBox.getOrigin() + boundingBox.getSize() - center;
+  vec3 n = XMVectorAbs(plane.normal);
+  float r = XMVectorGetX(XMVector3Dot(e, n));
+  return r <= plane.signedDistanceTo(center);
+}
+
+std::pair<bool, bool> FrustumQuadTreeSearch::operator()(const QuadTreeRegion &region) const
+{
+  AABB box{ { region.minX, minY, region.minY }, { region.maxX-region.minX, maxY-minY, region.maxY-region.minY } };
+  bool overlaps = frustum.isOnFrustum(box);
+  bool contains = overlaps && frustum.isFullyInFrustum(box);
+  return { contains, overlaps };
+}
+
 }
\ No newline at end of file
@@ -1,10 +1,13 @@
 #pragma once
 
+#include <utility>
 #include <variant>
 
 #include "utils/aabb.h"
 #include "utils/math.h"
 
+struct QuadTreeRegion;
+
 namespace pbl
 {
 
@@ -107,12 +110,33 @@ struct Frustum
   Plane nearFace;
 
   bool isOnFrustum(const AABB &boudingBox) const;
+  bool isFullyInFrustum(const AABB &boundingBox) const;
 
   static Frustum createFrustumFromCamera(const Camera &cam);
   static Frustum createFrustumFromProjection(const Camera &cam, const OrthographicProjection &proj);
   static Frustum createFrustumFromProjection(const Camera &cam, const PerspectiveProjection &proj);
 
   static bool isOnOrForwardPlan(const Plane &plane, const AABB &boundingBox);
+  static bool isFullyForwardPlan(const Plane &plane, const AABB &boundingBox);
+};
+
+/*
+ * A quad tree search (see is_quad_tree_search_v) for objects that are
+ * visible to a frustum.
+ *
+ * Quad tree regions lie on the XZ plane, a region is tested as the box
+ * spanning over it between minY and maxY, which must enclose the objects
+ * stored in the tree. Overlaps are conservative, some objects that are not
+ * quite visible may be reported; contains is exact so that cells fully
+ * inside of the frustum are collected without testing their members.
+ */
+struct FrustumQuadTreeSearch
+{
+  Frustum frustum;
+  float minY = -1e6f;
+  float maxY = +1e6f;
+
+  std::pair<bool, bool> operator()(const QuadTreeRegion &region) const;
 };
 
 
@@ -2,6 +2,7 @@
 
 #include "directxlib.h"
 #include "utils/debug.h"
+#include "utils/parallel.h"
 
 namespace pbl
 {
@@ -68,6 +69,24 @@ std::pair<std::shared_ptr<Model>, std::shared_ptr<Mesh>> GraphicalResourceRegist
   };
 }
 
+void GraphicalResourceRegistry::preloadModelMeshes(std::span<const filepath> paths)
+{
+  std::vector<filepath> newPaths;
+  for (const filepath &path : paths)
+    if (!m_models.contains(path) && !m_meshes.contains(path) && std::ranges::find(newPaths, path) == newPaths.end())
+      newPaths.push_back(path);
+
+  std::vector<ModelFile> files(newPaths.size());
+  utils::parallelFor(newPaths.size(), [&](size_t i) {
+    files[i] = ModelLoader::decodeModelFile(utils::widestring2string(newPaths[i]).c_str(), true);
+  });
+
+  for (size_t i = 0; i < newPaths.size(); i++) {
+    m_meshes[newPaths[i]] = std::make_shared<Mesh>(ModelLoader::buildMesh(files[i], *this));
+    m_models[newPaths[i]] = std::make_shared<Model>(std::move(files[i].model));
+  }
+}
+
 void GraphicalResourceRegistry::reloadShaders()
 {
   for(auto &[file, oldEffect] : m_effects) {
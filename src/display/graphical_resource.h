@@ -1,5 +1,7 @@
 #pragma once
 
+#include <span>
+
 #include "texture.h"
 #include "shader.h"
 #include "mesh.h"
@@ -35,6 +37,12 @@ public:
   shared_ptr<Model> loadModel(const filepath &path);
   // whenever possible, prefer loading both the mesh and the model at the same time
   std::pair<shared_ptr<Model>, shared_ptr<Mesh>> loadModelMesh(const filepath &path);
+  /*
+   * Loads the models and meshes of many files at once, for loadModelMesh
+   * to find them in cache. Model files are decoded in parallel, meshes are
+   * built on the calling thread. Files already loaded are skipped.
+   */
+  void preloadModelMeshes(std::span<const filepath> paths);
 
   void reloadShaders();
 
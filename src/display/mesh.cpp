@@ -138,7 +138,7 @@ struct MaterialData
   float specularExponent = 0;
   float dissolve = 0; // 1-transparency
   float opticalDensity = 0; // index of refraction
-  Texture ambiantTexture;
+  fs::path ambiantTexture;
   // FUTURE add all other kinds of textures
 };
 
@@ -150,8 +150,6 @@ struct VertexData
   size_t materialIndex;
 };
 
-static const MaterialData DEFAULT_MATERIAL;
-
 static void skipStreamText(std::istream &stream, const char *text)
 {
   char c;
@@ -164,7 +162,7 @@ static void skipStreamText(std::istream &stream, const char *text)
   }
 }
 
-void loadMaterialFile(const fs::path &filePath, std::vector<MaterialData> &materials, GraphicalResourceRegistry &resources)
+void loadMaterialFile(const fs::path &filePath, std::vector<MaterialData> &materials)
 {
   std::ifstream matFile{ filePath };
   if (!matFile) throw std::runtime_error("Could not load material file");
@@ -206,7 +204,7 @@ void loadMaterialFile(const fs::path &filePath, std::vector<MaterialData> &mater
       std::getline(ss, ambiantTexturePath);
       if (ambiantTexturePath.ends_with(".png"))
         ambiantTexturePath.replace(ambiantTexturePath.end()-4, ambiantTexturePath.end(), ".dds");
-      materials[currentMaterial].ambiantTexture = resources.loadTexture(filePath.parent_path() / ambiantTexturePath);
+      materials[currentMaterial].ambiantTexture = filePath.parent_path() / ambiantTexturePath;
 
     } else if (currentLine.starts_with("newmtl ")) { // switch to a new material
       MaterialData &mat = materials.emplace_back();
@@ -223,50 +221,7 @@ void loadMaterialFile(const fs::path &filePath, std::vector<MaterialData> &mater
     throw std::runtime_error("Could not fully read a material file, error on line " + std::to_string(currentLineIndex));
 }
 
-Mesh buildMeshFromRawData(
-  const std::vector<VertexData> &verticesData,
-  const std::vector<BaseVertex> &vertices,
-  const std::vector<index_t> &indices,
-  const std::vector<MaterialData> &materialsData,
-  GraphicalResourceRegistry &resources)
-{
-  std::vector<Mesh::SubMesh> submeshes;
-
-  PBL_ASSERT(vertices.size() * sizeof(BaseVertex) <= (std::numeric_limits<UINT>::max)(), "Too many indices for vbo");
-  PBL_ASSERT(indices.size() <= (std::numeric_limits<UINT>::max)(), "Too many indices for ibo");
-
-  ShaderVertexLayout layout = BaseVertex::getShaderVertexLayout();
-
-  // build submeshes
-  for (size_t firstGroupVertex = 0, i = 0; i < indices.size(); i++) {
-    if (i != indices.size() - 1 && verticesData[indices[i+1]].materialIndex == verticesData[indices[i]].materialIndex)
-      continue;
-    const MaterialData &materialData = materialsData.empty() ? DEFAULT_MATERIAL : materialsData[verticesData[indices[i]].materialIndex];
-    Mesh::SubMesh &submesh = submeshes.emplace_back();
-    submesh.indexCount = static_cast<index_t>(i - firstGroupVertex + 1);
-    submesh.indexOffset = static_cast<index_t>(firstGroupVertex);
-    submesh.textures = std::vector<TextureBinding>{ { "objectTexture", materialData.ambiantTexture } };
-    submesh.samplers = std::vector<SamplerBinding>{ { "samplerState", TextureManager::getSampler(SamplerState::BASIC) } };
-    submesh.material.diffuse  = { materialData.diffuse.x,  materialData.diffuse.y,  materialData.diffuse.z,  1 };
-    submesh.material.specular = { materialData.specular.x, materialData.specular.y, materialData.specular.z, 1 };
-    submesh.material.specularExponent = materialData.dissolve;
-    submesh.effect = resources.loadEffect(L"res/shaders/miniphong.fx", layout);
-    firstGroupVertex = i+1;
-  }
-
-  GenericBuffer vbo(sizeof(BaseVertex) * vertices.size(), GenericBuffer::BUFFER_VERTEX, vertices.data());
-  GenericBuffer ibo(sizeof(index_t) * indices.size(), GenericBuffer::BUFFER_INDEX, indices.data());
-
-  return Mesh(
-    std::move(ibo),
-    std::move(vbo),
-    sizeof(BaseVertex),
-    std::move(submeshes),
-    Mesh::computeBoundingBox(vertices)
-  );
-}
-
-std::pair<Model, Mesh> loadMeshFile(const fs::path &path, GraphicalResourceRegistry *resources)
+ModelFile decodeMeshFile(const fs::path &path, bool withMaterials)
 {
   using namespace objloader;
 
@@ -341,12 +296,12 @@ std::pair<Model, Mesh> loadMeshFile(const fs::path &path, GraphicalResourceRegis
         indices.push_back(surfaceIndices[0]);
       }
 
-    } else if (currentLine.starts_with("mtllib ") && resources != nullptr) { // load a new material file
+    } else if (currentLine.starts_with("mtllib ") && withMaterials) { // load a new material file
       std::string materialFilePath;
       std::getline(ss, materialFilePath);
-      loadMaterialFile(path.parent_path() / materialFilePath, materials, *resources);
+      loadMaterialFile(path.parent_path() / materialFilePath, materials);
 
-    } else if (currentLine.starts_with("usemtl ") && resources != nullptr)  { // use a material for the next object
+    } else if (currentLine.starts_with("usemtl ") && withMaterials)  { // use a material for the next object
       std::string matName;
       std::getline(ss, matName);
       auto e = std::ranges::find_if(materials, [&matName](const MaterialData &mat) { return mat.name == matName; });
@@ -362,26 +317,80 @@ std::pair<Model, Mesh> loadMeshFile(const fs::path &path, GraphicalResourceRegis
   if (!modelFile && !modelFile.eof())
     throw std::runtime_error("Could not fully read a model file, error on line " + std::to_string(currentLineIndex+1));
 
-  std::pair<Model, Mesh> meshModel;
-  auto &[model, mesh] = meshModel;
+  PBL_ASSERT(vertices.size() * sizeof(BaseVertex) <= (std::numeric_limits<UINT>::max)(), "Too many indices for vbo");
+  PBL_ASSERT(indices.size() <= (std::numeric_limits<UINT>::max)(), "Too many indices for ibo");
+
+  ModelFile file;
 
-  model.indices = std::move(indices);
-  model.vertices.reserve(vertices.size());
-  std::ranges::transform(vertices, std::back_inserter(model.vertices), [](const VertexData &v) {
+  // group consecutive indices by material
+  for (size_t firstGroupVertex = 0, i = 0; i < indices.size(); i++) {
+    if (i != indices.size() - 1 && vertices[indices[i+1]].materialIndex == vertices[indices[i]].materialIndex)
+      continue;
+    file.parts.push_back({
+      static_cast<index_t>(firstGroupVertex),
+      static_cast<index_t>(i - firstGroupVertex + 1),
+      vertices[indices[i]].materialIndex });
+    firstGroupVertex = i+1;
+  }
+
+  file.model.indices = std::move(indices);
+  file.model.vertices.reserve(vertices.size());
+  std::ranges::transform(vertices, std::back_inserter(file.model.vertices), [](const VertexData &v) {
     return BaseVertex{ v.position, v.normal, v.texCoord };
   });
+  file.materials.reserve(materials.size());
+  std::ranges::transform(materials, std::back_inserter(file.materials), [](MaterialData &m) {
+    return ModelFile::Material{ m.diffuse, m.specular, m.dissolve, std::move(m.ambiantTexture) };
+  });
 
-  if(resources != nullptr)
-    mesh = buildMeshFromRawData(vertices, model.vertices, model.indices, materials, *resources);
-
-  return meshModel;
+  return file;
 }
 
 } // !namespace objloader
 
+ModelFile ModelLoader::decodeModelFile(const char *path, bool withMaterials)
+{
+  return objloader::decodeMeshFile(path, withMaterials);
+}
+
+Mesh ModelLoader::buildMesh(const ModelFile &file, GraphicalResourceRegistry &resources)
+{
+  static const ModelFile::Material DEFAULT_MATERIAL;
+
+  std::vector<Mesh::SubMesh> submeshes;
+  ShaderVertexLayout layout = BaseVertex::getShaderVertexLayout();
+
+  for (const ModelFile::Part &part : file.parts) {
+    const ModelFile::Material &material = file.materials.empty() ? DEFAULT_MATERIAL : file.materials[part.material];
+    Mesh::SubMesh &submesh = submeshes.emplace_back();
+    submesh.indexCount = part.indexCount;
+    submesh.indexOffset = part.indexOffset;
+    submesh.textures = std::vector<TextureBinding>{ { "objectTexture", material.texture.empty() ? Texture{} : resources.loadTexture(material.texture) } };
+    submesh.samplers = std::vector<SamplerBinding>{ { "samplerState", TextureManager::getSampler(SamplerState::BASIC) } };
+    submesh.material.diffuse  = { material.diffuse.x,  material.diffuse.y,  material.diffuse.z,  1 };
+    submesh.material.specular = { material.specular.x, material.specular.y, material.specular.z, 1 };
+    submesh.material.specularExponent = material.dissolve;
+    submesh.effect = resources.loadEffect(L"res/shaders/miniphong.fx", layout);
+  }
+
+  const Model &model = file.model;
+  GenericBuffer vbo(sizeof(BaseVertex) * model.vertices.size(), GenericBuffer::BUFFER_VERTEX, model.vertices.data());
+  GenericBuffer ibo(sizeof(Mesh::index_t) * model.indices.size(), GenericBuffer::BUFFER_INDEX, model.indices.data());
+
+  return Mesh(
+    std::move(ibo),
+    std::move(vbo),
+    sizeof(BaseVertex),
+    std::move(submeshes),
+    Mesh::computeBoundingBox(model.vertices)
+  );
+}
+
 std::pair<Model, Mesh> ModelLoader::loadModelMesh(const char *path, GraphicalResourceRegistry *resources)
 {
-  return objloader::loadMeshFile(path, resources);
+  ModelFile file = decodeModelFile(path, resources != nullptr);
+  Mesh mesh = resources != nullptr ? buildMesh(file, *resources) : Mesh{};
+  return { std::move(file.model), std::move(mesh) };
 }
 
 } // !namespace pbl
\ No newline at end of file
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <filesystem>
 #include <vector>
 
 #include "utils/math.h"
@@ -85,9 +86,40 @@ private:
   AABB m_boundingBox;
 };
 
+/*
+ * The content of a model file, decoded without touching the gpu so that
+ * model files can be decoded on any thread, see ModelLoader::buildMesh.
+ */
+struct ModelFile
+{
+  struct Material
+  {
+    rvec3 diffuse{};
+    rvec3 specular{};
+    float dissolve = 0;
+    std::filesystem::path texture; // empty if the material has no texture
+  };
+
+  // consecutive indices drawn with the same material
+  struct Part
+  {
+    Model::index_t indexOffset;
+    Model::index_t indexCount;
+    size_t         material; // index in materials, if there are any
+  };
+
+  Model                 model;
+  std::vector<Material> materials;
+  std::vector<Part>     parts;
+};
+
 class ModelLoader
 {
 public:
+  // material files are only read withMaterials, they are only used to build meshes
+  static ModelFile decodeModelFile(const char *path, bool withMaterials);
+  static Mesh buildMesh(const ModelFile &file, GraphicalResourceRegistry &resourcesLoader);
+
   static std::pair<Model, Mesh> loadModelMesh(const char *path, GraphicalResourceRegistry *resourcesLoader);
 
   static Model loadModel(const char *path)
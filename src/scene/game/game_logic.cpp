@@ -96,7 +96,10 @@ void GameLogic::makePlayerFollowPostEndTrack(float deltaTime)
 {
   Transform currentTransform = m_player->getVehicle().getTransform();
   vec3 currentTarget = currentTransform.transform(Camera::FORWARD * 10.f);
-  vec3 targetPosition = *std::ranges::min_element(m_postEndTrack.points, std::less{}, [&](vec3 p) { return XMVectorGetX(XMVector3Length(p - currentTarget)); });
+  if (m_postEndTrack.empty()) return;
+  TrackProjectionIndex::Projection target = m_postEndTrack.project(currentTarget, m_postEndTrackSegment);
+  m_postEndTrackSegment = target.segment;
+  vec3 targetPosition = target.position;
   quat targetDirection = Camera::quaternionLookAt(currentTransform.position, targetPosition);
   quat newDirection = XMQuaternionSlerp(targetDirection, currentTransform.rotation, .9f);
   vec3 newPosition = currentTransform.position + XMVector3Rotate(Camera::FORWARD, newDirection) * deltaTime * 80.f;
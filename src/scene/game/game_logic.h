@@ -3,6 +3,7 @@
 #include "game_ui.h"
 #include "player.h"
 #include "utils/bezier_curve.h"
+#include "utils/track_projection.h"
 
 class GameLogic : public pbx::PhysicsEventHandler
 {
@@ -25,7 +26,8 @@ private:
 	Transform m_checkpointTransform;
 	unsigned int m_turnNb = 1;
 	unsigned int m_turnsRequired = 1;
-	DiscreteCurve m_postEndTrack;
+	TrackProjectionIndex m_postEndTrack;
+	size_t m_postEndTrackSegment = 0; // of the last target, the next one is searched around it
 
 	// empty when no uiManager is provided to GameLogic of after the game's end
 	std::optional<GameUI> m_gameUI;
@@ -59,7 +61,7 @@ public:
 	void setPlayerToCheckpoint() { m_player->resetPosition(m_checkpointTransform); }
 
 	// set the track the player vehicle will automatically follow once they cross the finish line
-	void setPostEndTrack(DiscreteCurve curve) { m_postEndTrack = std::move(curve); }
+	void setPostEndTrack(DiscreteCurve curve) { m_postEndTrack = TrackProjectionIndex{ std::move(curve.points) }; }
 
 	const Transform &getCurrentRespawnPosition() const { return m_checkpointTransform; }
 	Player *getPlayer() const { return m_player; }
@@ -10,8 +10,10 @@
 #include "display/frame_buffer.h"
 #include "display/renderer.h"
 #include "inputs/user_inputs.h"
+#include "physics/physxlib.h"
 #include "scene/scene_manager.h"
 #include "serial/game_serializer.h"
+#include "utils/debug.h"
 #include "world/trigger_box.h"
 
 GameScene::GameScene()
@@ -77,6 +79,7 @@ void GameScene::render()
   { // render world objects
     for (auto &obj : m_objects)
       obj->render(worldRenderContext);
+    m_staticProps.forEachVisibleProp(worldRenderContext.cameraFrustum, [&](pbl::WorldObject &prop) { prop.render(worldRenderContext); });
   }
 
   { // render other global objects
@@ -150,6 +153,7 @@ void GameScene::initSceneObjects()
   serializerResources.objects = &m_objects;
   serializerResources.physics = &m_physics;
   serializerResources.resources = &m_graphicalResources;
+  serializerResources.staticPropsIndex = &m_staticProps;
   pbl::GameSerializer serializer{ serializerResources };
 
   { // player object
@@ -252,6 +256,14 @@ void GameScene::initSceneObjects()
         m_physics.addBody(physics);
     }
   }
+  // static props are owned by their index, not by m_objects
+  m_staticProps.forEachProp([&](pbl::WorldObject &prop) {
+    pbx::PhysicsBody *physics = prop.buildPhysicsObject();
+    PBL_ASSERT(physics != nullptr, "A static prop has no physics body");
+    m_physics.addBody(physics);
+    PBL_ASSERT(std::ranges::all_of(physics->getActors(), [&](physx::PxRigidActor *actor) { return actor->getScene() == m_physics.getScene(); }),
+      "A static prop was not added to the physics world");
+  });
 }
 
 void GameScene::onSceneStateChange(pbl::SceneStateChange change)
@@ -7,6 +7,7 @@
 #include "display/skybox.h"
 #include "display/text.h"
 #include "physics/physics.h"
+#include "serial/static_props_index.h"
 #include "world/object.h"
 #include "scene/scene.h"
 #include "game_logic.h"
@@ -42,6 +43,7 @@ private:
   // -- world
   pbx::Physics                                   m_physics;
   std::vector<std::shared_ptr<pbl::WorldObject>> m_objects;
+  pbl::StaticPropsIndex                          m_staticProps;
   std::shared_ptr<Sun>                           m_sun;
   std::shared_ptr<PlayerVehicle>                 m_playerVehicle;
   std::vector<std::shared_ptr<pbl::WorldObject>> m_shadowCastingObjects;
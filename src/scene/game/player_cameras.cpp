@@ -21,22 +21,11 @@ void CameraController::updateCameraProjection(pbl::Camera &camera)
   camera.setProjection(std::visit(visitor, camera.getProjection()));
 }
 
-vec3 CameraRail::getClosestPointOnTrack(vec3 p) const
-{
-  vec3 nearest = points[0];
-  float nearestDist = XMVectorGetX(XMVector3Length(p-nearest));
-  for(size_t i = 0; i < points.size()-1; i++) {
-    const vec3 &p0 = points[i], &p1 = points[i+1];
-    vec3 r = p1-p0;
-    vec3 d = XMVector3Normalize(r);
-    vec3 nearestOnSegment = p0 + d * mathf::clamp(XMVectorGetX(XMVector3Dot(p - p0, d)), 0.f, XMVectorGetX(XMVector3Length(r)));
-    float dist = XMVectorGetX(XMVector3Length(p-nearestOnSegment)); // suboptimal
-    if(nearestDist > dist) {
-      nearestDist = dist;
-      nearest = nearestOnSegment;
-    }
-  }
-  return nearest;
+vec3 CameraRail::getClosestPointOnTrack(vec3 p)
+{
+  TrackProjectionIndex::Projection projection = track.project(p, lastSegment);
+  lastSegment = projection.segment;
+  return projection.position;
 }
 
 void ShakeParameters::addShake(float duration, float force, int frameSkip)
@@ -171,6 +160,7 @@ void FixedCameraController::update(double delta)
   if(XMVectorGetX(XMVector3LengthSq(m_offset)) == 0.f) {
     float closestDistance = std::numeric_limits<float>::max();
     for(CameraRail &rail : m_rails) {
+      if (rail.track.empty()) continue;
       vec3 c = rail.getClosestPointOnTrack(playerPos);
       float d = XMVectorGetX(XMVector3Length(c - playerPos));
       if(d < closestDistance) {
@@ -6,6 +6,7 @@
 #include "player_vehicle.h"
 #include "display/camera.h"
 #include "utils/math.h"
+#include "utils/track_projection.h"
 
 
 class CameraController
@@ -29,9 +30,12 @@ protected:
 };
 
 struct CameraRail {
-  std::vector<vec3> points;
+  TrackProjectionIndex track;
+  size_t lastSegment = 0; // of the last closest point, the next one is searched around it
 
-  vec3 getClosestPointOnTrack(vec3 p) const;
+  CameraRail(std::vector<vec3> points) : track(std::move(points)) {}
+
+  vec3 getClosestPointOnTrack(vec3 p);
 };
 
 struct ShakeParameters
@@ -3,10 +3,7 @@
 #include "display/renderer.h"
 #include "physics/physxlib.h"
 
-static constexpr int   MAX_BISECTION_ITERATIONS = 8;
-static constexpr float TARGET_ANCHORS_DISTANCE = 2.f;
-static constexpr float ACCEPTED_ANCHORS_DISTANCE_DELTA = .1f;
-static constexpr float BISECTION_INITIAL_STEP = .2f;
+static constexpr float TEXTURE_LENGTH = 20.f; // distance along the track covered by the texture
 
 Track::Track(BezierCurve curve, TrackProfile profile, std::vector<AttractionPoint> attractionPoints, pbl::GraphicalResourceRegistry &resources)
   : Track(
@@ -19,10 +16,26 @@ Track::Track(BezierCurve curve, TrackProfile profile, std::vector<AttractionPoin
 {
 }
 
-Track::Track(BezierCurve curve, TrackProfile profile, std::vector<AttractionPoint> attractionPoints, pbl::Effect *effect, const pbl::Texture &texture)
+Track::Track(BezierCurve curve, TrackProfile profile, std::vector<AttractionPoint> attractionPoints, pbl::Effect *effect, const pbl::Texture &texture,
+  TessellationSettings tessellation)
+  : Track(std::move(curve), std::move(profile), std::move(attractionPoints), tessellation)
+{
+  uploadMesh(effect, texture);
+}
+
+Track::Track(BezierCurve curve, TrackProfile profile, std::vector<AttractionPoint> attractionPoints, TessellationSettings tessellation)
   : m_curve(std::move(curve))
   , m_profile(std::move(profile))
   , m_attractionPoints(std::move(attractionPoints))
+{
+  std::vector<AnchorPoint> anchorPoints = sampleEvenlySpacedPoints(tessellation.minSegmentLength);
+  if (tessellation.adaptive)
+    anchorPoints = removeFlatAnchorPoints(anchorPoints, tessellation);
+  m_model.vertices = createMeshVertices(anchorPoints);
+  m_model.indices = createMeshIndices(anchorPoints);
+}
+
+void Track::uploadMesh(pbl::Effect *effect, const pbl::Texture &texture)
 {
   setMesh(std::make_shared<pbl::Mesh>(buildTrackMesh(effect, texture)));
 }
@@ -31,12 +44,7 @@ pbx::PhysicsBody *Track::buildPhysicsObject()
 {
   if (m_physicsBody) return m_physicsBody.get();
 
-  std::vector<AnchorPoint> anchorPoints = sampleEvenlySpacedPoints();
-
-  physx::PxTriangleMeshGeometry geom(makePhysicsMeshFromModel({
-    createMeshVertices(anchorPoints),
-    createMeshIndices(anchorPoints)
-  }));
+  physx::PxTriangleMeshGeometry geom(makePhysicsMeshFromModel(m_model));
 
   m_physicsBody = std::make_unique<pbx::PhysicsBody>(this);
   m_physicsBody->addActor(PxCreateStatic(pbx::Physics::getSdk(), physx::PxTransform({ 0,0,0 }), geom, *pbx::Physics::getSdk().createMaterial(1, 1, .2f)));
@@ -62,14 +70,10 @@ pbl::Mesh Track::buildTrackMesh(pbl::Effect *effect, const pbl::Texture &texture
 {
   using namespace pbl;
 
-  std::vector<AnchorPoint>  anchorPoints = sampleEvenlySpacedPoints();
-  std::vector<BaseVertex>   meshVertices = createMeshVertices(anchorPoints);
-  std::vector<Mesh::index_t> meshIndices = createMeshIndices(anchorPoints);
-
   std::vector<Mesh::SubMesh> submeshes;
   Mesh::SubMesh submesh;
   submesh.indexOffset = 0;
-  submesh.indexCount = static_cast<Mesh::index_t>(meshIndices.size());
+  submesh.indexCount = static_cast<Mesh::index_t>(m_model.indices.size());
   submesh.effect = effect;
   submesh.textures = std::vector<TextureBinding>{ { "objectTexture", texture } };
   submesh.samplers = std::vector<SamplerBinding>{ { "samplerState", TextureManager::getSampler(SamplerState::BASIC) } };
@@ -78,50 +82,74 @@ pbl::Mesh Track::buildTrackMesh(pbl::Effect *effect, const pbl::Texture &texture
   submesh.material.specularExponent = 2.f;
   submeshes.push_back(submesh);
 
-  return Mesh(meshIndices, meshVertices, std::move(submeshes));
+  return Mesh(m_model.indices, m_model.vertices, std::move(submeshes));
 }
 
-std::vector<Track::AnchorPoint> Track::sampleEvenlySpacedPoints() const
+std::vector<Track::AnchorPoint> Track::sampleEvenlySpacedPoints(float spacing) const
 {
   std::vector<AnchorPoint> points;
 
-  vec3 prevPoint = m_curve.samplePoint(0);
-  float t = 0;
-  while(t < static_cast<float>(m_curve.controlPoints.size())-1) {
-    vec3 nextPoint;
-
-    // perform a bisection to find the next anchor point
-    float bisectIntervalMin = t;
-    float bisectIntervalMax = t + BISECTION_INITIAL_STEP*2.f;
-    t += BISECTION_INITIAL_STEP;
-    for(int i = 0; i < MAX_BISECTION_ITERATIONS; i++) {
-      nextPoint = m_curve.samplePoint(t);
-      float dist = XMVectorGetX(XMVector3Length(prevPoint - nextPoint));
-      if (std::abs(dist - TARGET_ANCHORS_DISTANCE) < ACCEPTED_ANCHORS_DISTANCE_DELTA)
-        break;
-      if(dist < TARGET_ANCHORS_DISTANCE) {
-        bisectIntervalMin = t;
-        t = (t + bisectIntervalMax) * .5f;
-      } else {
-        bisectIntervalMax = t;
-        t = (t + bisectIntervalMin) * .5f;
-      }
-    }
+  std::vector<float> parameters = ArcLengthTable(m_curve).getEvenlySpacedParameters(m_curve, spacing);
+  std::vector<vec3> curvePoints(parameters.size());
+  m_curve.evaluate(parameters, curvePoints);
 
+  float distance = 0;
+  for(size_t i = 1; i < curvePoints.size(); i++) {
+    vec3 prevPoint = curvePoints[i-1];
+    vec3 nextPoint = curvePoints[i];
+    distance += XMVectorGetX(XMVector3Length(nextPoint - prevPoint));
     vec3 forward = XMVector3Normalize(nextPoint - prevPoint);
     vec3 up = getOrientedVertical(nextPoint, forward);
     vec3 right = XMVector3Normalize(XMVector3Cross(up, forward));
-    points.emplace_back(nextPoint, right, up, forward);
+    points.emplace_back(nextPoint, right, up, forward, distance);
+  }
 
-    prevPoint = nextPoint;
+  if (m_curve.isLoop && !points.empty()) {
+    // the texture continues over the closing section
+    AnchorPoint &closingPoint = points.emplace_back(points.front());
+    closingPoint.distance = points[points.size()-2].distance + XMVectorGetX(XMVector3Length(closingPoint.position - points[points.size()-2].position));
   }
 
-  if (m_curve.isLoop)
-    points.push_back(points.front());
+  return points;
+}
+
+std::vector<Track::AnchorPoint> Track::removeFlatAnchorPoints(const std::vector<AnchorPoint> &anchorPoints, const TessellationSettings &tessellation) const
+{
+  if (anchorPoints.size() < 3)
+    return anchorPoints;
+
+  // greedily extend each section for as long as the anchor points it skips are within tolerance
+  std::vector<AnchorPoint> points{ anchorPoints.front() };
+  size_t sectionBegin = 0;
+  for (size_t sectionEnd = 2; sectionEnd < anchorPoints.size(); sectionEnd++) {
+    const AnchorPoint &begin = anchorPoints[sectionBegin];
+    const AnchorPoint &end = anchorPoints[sectionEnd];
+    bool acceptable = end.distance - begin.distance <= tessellation.maxSegmentLength;
+    for (size_t i = sectionBegin+1; i < sectionEnd && acceptable; i++)
+      acceptable = getTessellationError(begin, end, anchorPoints[i]) <= tessellation.tolerance;
+    if (!acceptable) {
+      sectionBegin = sectionEnd-1;
+      points.push_back(anchorPoints[sectionBegin]);
+    }
+  }
+  points.push_back(anchorPoints.back());
 
   return points;
 }
 
+float Track::getTessellationError(const AnchorPoint &begin, const AnchorPoint &end, const AnchorPoint &removed) const
+{
+  // distance between the profile of the removed anchor point and the interpolated profile of the section
+  float k = (removed.distance - begin.distance) / (end.distance - begin.distance);
+  float error = 0;
+  for (const TrackPoint &p : m_profile) {
+    vec3 expected = removed.position + removed.right * p.x + removed.up * p.y;
+    vec3 interpolated = XMVectorLerp(begin.position + begin.right * p.x + begin.up * p.y, end.position + end.right * p.x + end.up * p.y, k);
+    error = std::max(error, XMVectorGetX(XMVector3Length(expected - interpolated)));
+  }
+  return error;
+}
+
 vec3 Track::getOrientedVertical(vec3 position, vec3 forward) const
 {
   vec3 up{ 0,1,0 };
@@ -139,8 +167,8 @@ std::vector<pbl::BaseVertex> Track::createMeshVertices(const std::vector<AnchorP
 {
   std::vector<pbl::BaseVertex> vertices;
 
-  float uvx = 0.f;
   for (const auto& anchorPoint : anchorPoints) {
+    float uvx = anchorPoint.distance / TEXTURE_LENGTH;
     for (size_t j = 0; j < m_profile.size()-1; j++) {
       const TrackPoint &vertex = m_profile[j];
       const TrackPoint &nextVertex = m_profile[j+1];
@@ -155,7 +183,6 @@ std::vector<pbl::BaseVertex> Track::createMeshVertices(const std::vector<AnchorP
       vertices.emplace_back(pos1, normal, uv1);
       vertices.emplace_back(pos2, normal, uv2);
     }
-    uvx+=0.1f;
   }
 
   std::array<std::pair<AnchorPoint, vec3>, 2> edgeAnchors{{
@@ -2,9 +2,27 @@
 
 #include "display/graphical_resource.h"
 #include "physics/physics.h"
+#include "serial/serial_fields.h"
 #include "utils/bezier_curve.h"
 #include "world/object.h"
 
+/*
+ * How the curve is cut into track sections. Sections are first sampled
+ * evenly, minSegmentLength apart. In adaptive mode sections that can be
+ * removed are, as long as the profile of the track in the removed
+ * sections stays within tolerance of the remaining geometry (curvature
+ * and twist of the track both move the profile) and sections stay at
+ * most maxSegmentLength apart.
+ * Declared outside of Track to be usable as a default argument of its
+ * constructors.
+ */
+struct TrackTessellationSettings {
+  bool  adaptive = true;
+  float minSegmentLength = 2.f;
+  float maxSegmentLength = 24.f;
+  float tolerance = .05f;
+};
+
 class Track : public pbl::WorldProp
 {
 private:
@@ -13,12 +31,20 @@ private:
     vec3 right;
     vec3 up;
     vec3 forward;
+    float distance; // along the curve, from its start
   };
 
 public:
   struct AttractionPoint {
     vec3 position;
     float strength;
+
+    static constexpr auto fields()
+    {
+      return std::make_tuple(
+        pbl::InlinedSerialField{ &AttractionPoint::position },
+        pbl::SerialField{ "strength", &AttractionPoint::strength });
+    }
   };
 
   struct TrackPoint {
@@ -28,6 +54,8 @@ public:
 
   using TrackProfile = std::vector<TrackPoint>;
 
+  using TessellationSettings = TrackTessellationSettings;
+
   struct TrackProfileTemplate {
     float innerWidth = 20.f;
     float height = 1.f;
@@ -35,18 +63,33 @@ public:
     float bordersWidth = 4.5f;
 
     TrackProfile buildProfile() const;
+
+    static constexpr auto fields()
+    {
+      return std::make_tuple(
+        pbl::SerialField{ "inner_width",    &TrackProfileTemplate::innerWidth    },
+        pbl::SerialField{ "height",         &TrackProfileTemplate::height        },
+        pbl::SerialField{ "borders_offset", &TrackProfileTemplate::bordersOffset },
+        pbl::SerialField{ "borders_width",  &TrackProfileTemplate::bordersWidth  });
+    }
   };
     
 public:
   Track(BezierCurve curve, TrackProfile profile, std::vector<AttractionPoint> attractionPoints, pbl::GraphicalResourceRegistry &resources);
-  Track(BezierCurve curve, TrackProfile profile, std::vector<AttractionPoint> attractionPoints, pbl::Effect *effect, const pbl::Texture &texture);
+  Track(BezierCurve curve, TrackProfile profile, std::vector<AttractionPoint> attractionPoints, pbl::Effect *effect, const pbl::Texture &texture,
+    TessellationSettings tessellation={});
+  // only generates the track geometry, which can be done on any thread, the mesh must then be uploaded with uploadMesh
+  Track(BezierCurve curve, TrackProfile profile, std::vector<AttractionPoint> attractionPoints, TessellationSettings tessellation={});
 
+  void uploadMesh(pbl::Effect *effect, const pbl::Texture &texture);
   pbx::PhysicsBody *buildPhysicsObject() override;
 
 private:
   pbl::Mesh buildTrackMesh(pbl::Effect *effect, const pbl::Texture &texture) const;
 
-  std::vector<AnchorPoint> sampleEvenlySpacedPoints() const;
+  std::vector<AnchorPoint> sampleEvenlySpacedPoints(float spacing) const;
+  std::vector<AnchorPoint> removeFlatAnchorPoints(const std::vector<AnchorPoint> &anchorPoints, const TessellationSettings &tessellation) const;
+  float getTessellationError(const AnchorPoint &begin, const AnchorPoint &end, const AnchorPoint &removed) const;
   vec3 getOrientedVertical(vec3 position, vec3 forward) const;
   std::vector<pbl::BaseVertex> createMeshVertices(const std::vector<AnchorPoint> &anchorPoints) const;
   std::vector<pbl::Mesh::index_t> createMeshIndices(const std::vector<AnchorPoint> &anchorPoints) const;
@@ -56,4 +99,5 @@ private:
   BezierCurve m_curve;
   std::unique_ptr<pbx::PhysicsBody> m_physicsBody;
   std::vector<AttractionPoint> m_attractionPoints;
+  pbl::Model m_model; // geometry of the mesh, also used for the physics mesh
 };
@@ -9,12 +9,14 @@
 #define private public
 #include "world/quad_tree.h"
 #undef private
+#include "world/flat_quad_tree.h"
 
 class Cube : public WorldProp
 {
 public:
   Cube(GraphicalResourceRegistry &resources, float x, float y, float w, float h, float r)
     : WorldProp(resources.loadMesh(L"res/models/2_cube.obj"))
+    , m_baseX(x), m_baseY(y)
   {
     m_transform.position = { x, r, y, 1 };
     m_transform.scale = { w, .2f, h, 0 };
@@ -23,8 +25,16 @@ public:
 
   AABB getAABB() const { return m_aabb; }
 
+  // moves the cube on the XZ plane relatively to its spawn position
+  void setOffset(float dx, float dy)
+  {
+    m_transform.position = XMVectorSet(m_baseX + dx, XMVectorGetY(m_transform.position), m_baseY + dy, 1);
+    m_aabb = AABB(m_transform.position - m_transform.scale*.5f, m_transform.scale);
+  }
+
 private:
   AABB m_aabb;
+  float m_baseX, m_baseY;
 };
 
 struct CubeRegionMapper
@@ -38,34 +48,14 @@ struct CubeRegionMapper
   }
 };
 
-/*
- * The structure that allows to search in a quad-tree for objects that
- * are visible to a camera's frustum.
- *
- * Note that, as quad-trees operate on the 2D plane, some objects will
- * be reported "visible" although they should not be. The point is that
- * all visible objects are successfully reported.
- * If it is critical that objects that are not visible are discarded,
- * simply do a frustum-intersection check afterwise.
- */
-struct FrustumSearch {
-  static constexpr float WORLD_MIN_Y = -1e6;
-  static constexpr float WORLD_MAX_Y = 1e6;
-
-  Frustum frustum;
-
-  std::pair<bool, bool> operator()(const QuadTreeRegion &region) const
-  {
-    bool contains = false; // not quite sure of how to do the math here, in any case checking for overlaps is always enough (less performant though)
-    bool overlaps = frustum.isOnFrustum(AABB{ { region.minX, WORLD_MIN_Y, region.minY }, { region.maxX-region.minX, WORLD_MAX_Y-WORLD_MIN_Y, region.maxY-region.minY } });
-    return { contains, overlaps };
-  }
-};
-
 class ShowcaseQuadTree : public ShowcaseScene
 {
 public:
   using QTree = QuadTree<Cube *, CubeRegionMapper>;
+  using FlatQTree = FlatQuadTree<Cube *, CubeRegionMapper>;
+  // vertical range of the spawned cubes, the tighter the more tree cells are fully inside the search frustum
+  static constexpr float CUBES_MIN_Y = -1.2f;
+  static constexpr float CUBES_MAX_Y = +1.2f;
 
   ShowcaseQuadTree()
   {
@@ -86,29 +76,49 @@ protected:
     logs::scene.beginWindow();
     ImGui::Separator();
 
-    // in a real use-case the reset would probably be done every 6-7 frames
-    // and there would likely be two, one for static objects that never gets
-    // reset and one for dynamic objects
-    PBL_IMGUI_PROFILE("Reset duration",
-    m_quadTree.clear();
-    for (auto &cube : m_objects)
-      m_quadTree.add(std::static_pointer_cast<Cube>(cube).get());
+    // objects are added to the tree once, moving objects are updated in place
+    // instead of rebuilding the whole tree each frame
+    PBL_IMGUI_PROFILE("Update duration",
+    if (m_animateObjects) {
+      for (size_t i = 0; i < m_objects.size(); i++) {
+        Cube *cube = static_cast<Cube *>(m_objects[i].get());
+        float phase = m_worldTime + static_cast<float>(i);
+        cube->setOffset(std::cos(phase) * 2.f, std::sin(phase) * 2.f);
+        m_quadTree.update(m_handles[i]);
+      }
+    }
     )
 
-    std::vector<Cube *> cubesInRegion;
-    PBL_IMGUI_PROFILE("QuadTree fetch",
+    // the flat tree cannot be updated, it is rebuilt from scratch each frame
+    if (m_useFlatTree) {
+      PBL_IMGUI_PROFILE("Flat rebuild duration",
+      m_flatQuadTree.rebuild(m_objects | std::views::transform([](auto &obj) { return static_cast<Cube *>(obj.get()); }));
+      )
+    }
+
+    // found cubes are drawn as the tree is searched, nothing is collected
+    size_t foundCubesCount = 0;
+    auto drawFoundCube = [&](Cube *cube) {
+      Transform aabbT{};
+      aabbT.position = cube->getAABB().getOrigin()+cube->getAABB().getSize()*.5f;
+      aabbT.scale = cube->getAABB().getSize()*1.05f;
+      renderer::renderRect(aabbT.getWorldMatrix(), 0xff00ffff);
+      foundCubesCount++;
+    };
+    PBL_IMGUI_PROFILE("QuadTree search",
     if(m_useSearchRegion) {
-      m_quadTree.collectInBounds(cubesInRegion, m_searchRegion);
+      if (m_useFlatTree)
+        m_flatQuadTree.forEachInBounds(m_searchRegion, drawFoundCube);
+      else
+        m_quadTree.forEachInBounds(m_searchRegion, drawFoundCube);
     } else {
-      m_quadTree.collectMapInShape<Cube *>(cubesInRegion, FrustumSearch{ Frustum::createFrustumFromCamera(m_searchCamera) });
+      FrustumQuadTreeSearch search{ Frustum::createFrustumFromCamera(m_searchCamera), CUBES_MIN_Y, CUBES_MAX_Y };
+      if (m_useFlatTree)
+        m_flatQuadTree.forEachInShape(search, drawFoundCube);
+      else
+        m_quadTree.forEachInShape(search, drawFoundCube);
     }
     )
-    for (auto &obj : cubesInRegion) {
-        Transform aabbT{};
-        aabbT.position = obj->getAABB().getOrigin()+obj->getAABB().getSize()*.5f;
-        aabbT.scale = obj->getAABB().getSize()*1.05f;
-      renderer::renderRect(aabbT.getWorldMatrix(), 0xff00ffff);
-    }
 
     if(m_useSearchRegion) {
       renderer::renderLine(rvec3{ m_searchRegion.minX, +.5f, m_searchRegion.minY }, rvec3{ m_searchRegion.maxX, +.5f, m_searchRegion.minY }, 0xff305dec);
@@ -128,15 +138,20 @@ protected:
     ImGui::DragFloatRange2("Region X", &m_searchRegion.minX, &m_searchRegion.maxX, .5f, m_quadTree.getSpanningRegion().minX, m_quadTree.getSpanningRegion().maxX);
     ImGui::DragFloatRange2("Region Y", &m_searchRegion.minY, &m_searchRegion.maxY, .5f, m_quadTree.getSpanningRegion().minY, m_quadTree.getSpanningRegion().maxY);
     ImGui::EndDisabled();
-    ImGui::Text("Objects: %zu/%zu", cubesInRegion.size(), m_objects.size());
+    ImGui::Text("Objects: %zu/%zu", foundCubesCount, m_objects.size());
+    ImGui::Checkbox("Animate objects", &m_animateObjects);
+    ImGui::Checkbox("Use flat tree", &m_useFlatTree);
 
     int c = 0; drawQuadTreeCell(m_quadTree.m_rootCell, c);
 
     if (ImGui::Button("Add objects"))
       addObjects(100);
     ImGui::SameLine();
-    if (ImGui::Button("Clear objects"))
+    if (ImGui::Button("Clear objects")) {
       m_objects.clear();
+      m_handles.clear();
+      m_quadTree.clear();
+    }
 
     renderer::sendDebugDraws(m_freecam.getCamera());
     ImGui::Separator();
@@ -153,6 +168,7 @@ private:
       float x = rand(m_quadTree.getSpanningRegion().minX + w*.5f, m_quadTree.getSpanningRegion().maxX - w*.5f);
       float y = rand(m_quadTree.getSpanningRegion().minY + h*.5f, m_quadTree.getSpanningRegion().maxY - h*.5f);
       auto cube = std::make_shared<Cube>(m_graphicalResources, x, y, w, h, rand(-1,1));
+      m_handles.push_back(m_quadTree.add(cube.get()));
       m_objects.push_back(std::move(cube));
     }
   }
@@ -170,8 +186,8 @@ private:
     renderer::renderLine(rvec3{ r.minX, 0, r.minY }, rvec3{ r.minX, 0, r.maxY }, color);
     renderer::renderLine(rvec3{ r.maxX, 0, r.minY }, rvec3{ r.maxX, 0, r.maxY }, color);
     colorIndex++;
-    for (const auto &[key, value] : tree.m_members)
-      renderer::renderAABB(key->getAABB(), color);
+    for (const auto &member : tree.m_members)
+      renderer::renderAABB(member.value->getAABB(), color);
     if(tree.m_subcells) {
       drawQuadTreeCell(tree.m_subcells[0], colorIndex);
       drawQuadTreeCell(tree.m_subcells[1], colorIndex);
@@ -182,6 +198,10 @@ private:
 
 private:
   QTree m_quadTree{{ -1, -1, +101, +101 }};
+  std::vector<QTree::handle_type> m_handles; // same order as m_objects
+  bool m_animateObjects = false;
+  FlatQTree m_flatQuadTree{{ -1, -1, +101, +101 }};
+  bool m_useFlatTree = false;
 
   bool           m_useSearchRegion = true;
   QuadTreeRegion m_searchRegion{ 40, 40, 60, 60 };
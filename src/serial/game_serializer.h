@@ -1,15 +1,23 @@
 #pragma once
 
 #include <filesystem>
-#include <functional>
 #include <unordered_map>
 
-#include "json.h"
+#include "level_description.h"
 #include "physics/physics.h"
 #include "scene/game/game_logic.h"
+#include "static_props_index.h"
 #include "world/object.h"
 
 class WorldObjectEditor;
+class TrackEditor;
+class TerrainEditor;
+class WorldPropEditor;
+class TriggerBoxEditor;
+class GameLogicEditor;
+class BillboardsEditor;
+class CameraRailEditor;
+class TunnelEditor;
 
 namespace pbl
 {
@@ -20,36 +28,34 @@ struct SerializerResources {
   std::vector<std::shared_ptr<WorldObject>> *objects = nullptr;
   GameLogic *gameLogic = nullptr; // optional
   std::vector<std::unique_ptr<WorldObjectEditor>> *editors = nullptr; // optional
+  StaticPropsIndex *staticPropsIndex = nullptr; // optional
 };
 
+/*
+ * Instantiates the objects of level files and writes the objects of the
+ * editor back to level files. Objects are read from and written to a
+ * LevelDescription, whose types list their serialized fields: objects are
+ * instantiated by the overload of their description type and editors are
+ * described by the overload of their exact type, found by type id.
+ *
+ * Levels are loaded in two phases: the cpu work of all objects (decoding
+ * heightmaps and models, generating geometry, cooking physics meshes) is
+ * done in parallel first, then objects are instantiated in file order on
+ * the calling thread, which only uploads meshes and fills the scene.
+ */
 class GameSerializer
 {
 private:
   using ref_type = std::string;
-  using object_type_type = std::string;
-  using object_parser_type = std::function<std::shared_ptr<WorldObject>(const JsonObject &)>;
-  using object_serializer_type = std::function<std::optional<JsonObject>(const WorldObjectEditor *)>;
-
-  struct ObjectSerializer {
-    object_parser_type parse;
-    object_serializer_type serialize;
-  };
+  using describer_type = LevelObjectDescription(*)(const WorldObjectEditor &);
 
 public:
-    GameSerializer(const GameSerializer &) = delete;
-    GameSerializer &operator=(const GameSerializer &) = delete;
-    GameSerializer &operator=(GameSerializer &) = delete;
-    GameSerializer(GameSerializer &&moved) noexcept :
-        m_resources(std::move(moved.m_resources)),
-        m_referencedObjects(std::move(moved.m_referencedObjects))
-    {
-        fillInParsers();
-    }
+  GameSerializer(const GameSerializer &) = delete;
+  GameSerializer &operator=(const GameSerializer &) = delete;
+  GameSerializer(GameSerializer &&) noexcept = default;
   explicit GameSerializer(const SerializerResources &resources)
     : m_resources(resources)
-  {
-    fillInParsers();
-  }
+  {}
 
   void loadLevelFile(const std::filesystem::path &file);
   void writeLevelFile(const std::filesystem::path &file) const;
@@ -58,22 +64,42 @@ public:
   std::shared_ptr<WorldObject> getReferencedObject(const std::string &exactRef) const;
 
 private:
-  void fillInParsers();
-  void addParser(const object_type_type &name, object_parser_type &&parser, object_serializer_type &&serializer);
+  // the result of the parallel phase of loading for one object, see prepareObjects
+  struct PreparedObject {
+    std::shared_ptr<WorldObject> object;                // terrains and tracks, without their mesh
+    physx::PxTriangleMesh       *physicsMesh = nullptr; // props, shared by the props of a same model file
+  };
+
+  std::vector<PreparedObject> prepareObjects(const LevelDescription &level);
+
+  std::shared_ptr<WorldObject> instantiate(const LevelObjectDescription &object, TrackDescription &description, PreparedObject &prepared);
+  std::shared_ptr<WorldObject> instantiate(const LevelObjectDescription &object, TerrainDescription &description, PreparedObject &prepared);
+  std::shared_ptr<WorldObject> instantiate(const LevelObjectDescription &object, PropDescription &description, PreparedObject &prepared);
+  std::shared_ptr<WorldObject> instantiate(const LevelObjectDescription &object, TriggerBoxDescription &description, PreparedObject &prepared);
+  std::shared_ptr<WorldObject> instantiate(const LevelObjectDescription &object, GameLogicDescription &description, PreparedObject &prepared);
+  std::shared_ptr<WorldObject> instantiate(const LevelObjectDescription &object, BillboardsDescription &description, PreparedObject &prepared);
+  std::shared_ptr<WorldObject> instantiate(const LevelObjectDescription &object, CameraRailDescription &description, PreparedObject &prepared);
+  std::shared_ptr<WorldObject> instantiate(const LevelObjectDescription &object, TunnelDescription &description, PreparedObject &prepared);
+
+  static LevelObjectDescription describe(const TrackEditor &editor);
+  static LevelObjectDescription describe(const TerrainEditor &editor);
+  static LevelObjectDescription describe(const WorldPropEditor &editor);
+  static LevelObjectDescription describe(const TriggerBoxEditor &editor);
+  static LevelObjectDescription describe(const GameLogicEditor &editor);
+  static LevelObjectDescription describe(const BillboardsEditor &editor);
+  static LevelObjectDescription describe(const CameraRailEditor &editor);
+  static LevelObjectDescription describe(const TunnelEditor &editor);
+  template<class EditorType>
+  static LevelObjectDescription describeAs(const WorldObjectEditor &editor);
+  static describer_type getDescriber(const WorldObjectEditor &editor);
+
   std::string nextEditorName(const std::string &objectType) const;
 
-  static bool loadTransform(const std::shared_ptr<WorldObject> &worldObject, const JsonObject &object);
-  static std::optional<layer_t> loadLayer(const std::shared_ptr<WorldObject> &worldObject, const JsonObject &object);
-  static std::unique_ptr<WorldObjectEditor> loadEditor(std::unique_ptr<WorldObjectEditor> &&editor, const JsonObject& object);
-  static Transform parseTransform(const JsonObject &object);
-  static JsonObject serializeTransform(const Transform &transform);
-  static vec3 parseVec3(const JsonObject &object);
-  static JsonObject serializeVec3(const vec3 &vector);
-  static layer_t parseLayer(const JsonObject &object);
+  static bool loadTransform(const std::shared_ptr<WorldObject> &worldObject, const std::optional<Transform> &transform);
+  static std::optional<layer_t> loadLayer(const std::shared_ptr<WorldObject> &worldObject, const LevelObjectDescription &object);
+  static std::unique_ptr<WorldObjectEditor> loadEditor(std::unique_ptr<WorldObjectEditor> &&editor, const LevelObjectDescription &object);
 
 private:
-  std::unordered_map<object_type_type, ObjectSerializer> m_objectParsers;
-
   SerializerResources m_resources;
 
   std::unordered_map<ref_type, std::shared_ptr<WorldObject>> m_referencedObjects;
@@ -1,196 +1,367 @@
 ﻿#include "json.h"
 
-#include <fstream>
+#include <algorithm>
+#include <charconv>
+#include <iterator>
+
+#include "json_reader.h"
+#include "json_writer.h"
+#include "utils/mapped_file.h"
 
 template<class ...Ts>
 struct overloaded : public Ts... {
   using Ts::operator()...;
 };
 
-static char peekNonSpace(std::istream &is)
+// fields are written in alphabetical order so that the output does not depend on the hash map
+static void writeJson(JsonWriter &writer, const JsonValue &val) {
+  std::visit(overloaded{
+    [&](double x) { writer.value(x); },
+    [&](const JsonObject &j) {
+      std::vector<const std::pair<const std::string, JsonValue> *> fields;
+      fields.reserve(j.getFields().size());
+      for (const auto &field : j.getFields())
+        fields.push_back(&field);
+      std::ranges::sort(fields, std::less{}, [](auto *field) { return std::string_view{ field->first }; });
+      writer.beginObject();
+      for (const auto *field : fields) {
+        writer.key(field->first);
+        writeJson(writer, field->second);
+      }
+      writer.endObject();
+    },
+    [&](const std::vector<JsonValue> &a) {
+      writer.beginArray();
+      for (const JsonValue &element : a)
+        writeJson(writer, element);
+      writer.endArray();
+    },
+    [&](const std::string &s) { writer.value(s); },
+    [&](bool b) { writer.value(b); }
+  }, val.getVariant());
+}
+
+std::ostream& operator<<(std::ostream &os, const JsonValue &val)
 {
-  char c = static_cast<char>(is.peek());
-  while (is && (c == ' ' || c == '\t' || c == '\n' || c == '\r'))
-    c = (is.get(), static_cast<char>(is.peek()));
-  return c;
+  JsonWriter writer{ os, (os.flags() & std::ios::boolalpha) != 0 };
+  writeJson(writer, val);
+  return os;
 }
 
-static char getNonSpace(std::istream &is)
+namespace json
+{
+
+Reader::Reader(std::string_view text)
+  : m_text(text)
 {
-  peekNonSpace(is);
-  return static_cast<char>(is.get());
+  // files saved by some windows editors start with a BOM
+  if (m_text.starts_with("\xEF\xBB\xBF"))
+    m_position = 3;
 }
 
-static void skipText(const char *text, std::istream &is)
+void Reader::error(const std::string &message) const
 {
-  for(const char *c = text; *c; c++) {
-    if (char cc = static_cast<char>(is.get()); cc != *c)
-      throw json_parser_error("Expected " + std::string(text), cc);
+  size_t line = 1, column = 1;
+  for (size_t i = 0; i < m_position && i < m_text.size(); i++) {
+    if (m_text[i] == '\n') {
+      line++;
+      column = 1;
+    } else {
+      column++;
+    }
   }
+  throw json_parser_error(message, line, column);
 }
 
-static void prettyPrintJson(std::ostream &os, const JsonValue &val, int depth) {
-  auto writeName = [&](const std::string &name) {
-    os << '"' << name << '"'; // TODO escape string in json output
-  };
+void Reader::skipSpaces()
+{
+  while (m_position < m_text.size()) {
+    char c = m_text[m_position];
+    if (c != ' ' && c != '\n' && c != '\r' && c != '\t')
+      return;
+    m_position++;
+  }
+}
 
-  auto printLine = [&](int d) {
-    if (!(os.flags() & std::ios::boolalpha)) return;
-    constexpr int maxDepth = 10;
-    constexpr char spaces[maxDepth*2+1] = "                    ";
-    os << '\n';
-    while (d > 0) {
-      os.write(spaces, std::min(d*2, maxDepth));
-      d -= maxDepth;
-    }
-  };
+// returns the next non-space character without consuming it, or 0 at the end of the buffer
+char Reader::peekNonSpace()
+{
+  skipSpaces();
+  return m_position < m_text.size() ? m_text[m_position] : '\0';
+}
 
-  std::visit(overloaded{
-    [&](double x) { os << x; },
-    [&](const JsonObject &j) {
-      os << '{';
-      printLine(depth+1);
-      size_t i = 0;
-      std::vector<std::string> fieldNames;
-      fieldNames.reserve(j.getFields().size());
-      std::ranges::transform(j.getFields(), std::back_inserter(fieldNames), [](auto &kv) { return kv.first; });
-      std::ranges::sort(fieldNames);
-      for(std::string &name : fieldNames) {
-        writeName(name);
-        os << ": ";
-        prettyPrintJson(os, j.getFields().at(name), depth+1);
-        if (++i != j.getFields().size()) {
-          os << ",";
-          printLine(depth+1);
-        }
-      }
-      printLine(depth);
-      os << '}';
-    },
-    [&](const std::vector<JsonValue> &a) {
-      os << '[';
-      printLine(depth+1);
-      size_t i = 0;
-      for(const auto &fieldVal : a) {
-        prettyPrintJson(os, fieldVal, depth+1);
-        if (++i != a.size()) {
-          os << ", ";
-          printLine(depth+1);
-        }
-      }
-      printLine(depth);
-      os << ']';
-    },
-    [&](const std::string &s) {
-      writeName(s);
-    },
-    [&](bool b) {
-      os << (b ? "true" : "false");
-    }
-  }, val.getVariant());
+void Reader::expect(char expected, const char *context)
+{
+  if (peekNonSpace() != expected)
+    error(std::string("Expected '") + expected + "' " + context);
+  m_position++;
 }
 
-std::ostream& operator<<(std::ostream &os, const JsonValue &val)
+void Reader::expectEnd()
 {
-  prettyPrintJson(os, val, 0);
-  return os;
+  skipSpaces();
+  if (m_position != m_text.size())
+    error("Unexpected character after the json document");
 }
 
-namespace json
+Reader::TokenType Reader::peekValue(size_t depth)
 {
+  if (depth > MAX_DEPTH)
+    error("Json document is too deep");
+  char c = peekNonSpace();
+  if (c == '{') {
+    return TokenType::OBJECT;
+  } else if (c == '[') {
+    return TokenType::ARRAY;
+  } else if (c == '"') {
+    return TokenType::STRING;
+  } else if ((c >= '0' && c <= '9') || c == '-') {
+    return TokenType::NUMBER;
+  } else if (c == 't' || c == 'f') {
+    return TokenType::BOOLEAN;
+  } else if (m_position == m_text.size()) {
+    error("Unexpected end of json document");
+  } else {
+    error(std::string("Unexpected character '") + c + "'");
+  }
+}
 
-JsonValue parse(const std::string &text)
+bool Reader::nextElement(bool first, char closingChar, const char *errorMessage)
 {
-  std::stringstream ss{ text };
-  return parse(ss);
+  char c = peekNonSpace();
+  if (c == closingChar) {
+    m_position++;
+    return false;
+  }
+  if (first)
+    return true;
+  if (c != ',')
+    error(errorMessage);
+  m_position++;
+  return true;
 }
 
-JsonValue parseFile(const std::filesystem::path &filepath)
+double Reader::readNumber()
 {
-  std::ifstream is{ filepath };
-  if (!is) throw std::runtime_error("Could not open json file");
-  return parse(is);
+  // from_chars accepts more than json numbers (inf, nan, 1.), the number is validated by skipNumber first
+  std::string_view text = skipNumber();
+  double number;
+  auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), number);
+  if (ec == std::errc::invalid_argument || end != text.data() + text.size())
+    error("Invalid number");
+  if (ec == std::errc::result_out_of_range)
+    error("Number out of range");
+  return number;
 }
 
-JsonValue parse(std::istream &is)
+std::string_view Reader::skipNumber()
 {
-  char c = peekNonSpace(is);
+  size_t begin = m_position;
+  auto skipDigits = [&] {
+    size_t digitsBegin = m_position;
+    while (m_position < m_text.size() && m_text[m_position] >= '0' && m_text[m_position] <= '9')
+      m_position++;
+    if (m_position == digitsBegin)
+      error("Invalid number");
+  };
+  auto skipIf = [&](char c1, char c2) {
+    bool skipped = m_position < m_text.size() && (m_text[m_position] == c1 || m_text[m_position] == c2);
+    m_position += skipped;
+    return skipped;
+  };
+  skipIf('-', '-');
+  // no leading zeros, the integer part is either 0 or starts with a non-zero digit
+  if (!skipIf('0', '0'))
+    skipDigits();
+  if (skipIf('.', '.'))
+    skipDigits();
+  if (skipIf('e', 'E')) {
+    skipIf('+', '-');
+    skipDigits();
+  }
+  return m_text.substr(begin, m_position - begin);
+}
 
-  if(c == '{') {
-    is.get();
-    c = peekNonSpace(is);
-    JsonObject object;
-    if (c == '}') {
-      is.get();
-      return object;
-    }
-    while(true) {
-      c = peekNonSpace(is);
-      std::string fieldName;
-      if (c == '"') {
-        is.get();
-        char nameBuf[256];
-        is.get(nameBuf, sizeof(nameBuf), '"');
-        if ((c = static_cast<char>(is.get())) != '"') throw json_parser_error("Expected end-of-string '\"' for property name", c);
-        fieldName = nameBuf;
-      } else {
-        char nameBuf[256];
-        is.get(nameBuf, sizeof(nameBuf), ':');
-        fieldName = nameBuf;
-        if(fieldName.contains(' ')) throw json_parser_error("Got space in property name: " + fieldName);
-      }
-      if ((c = getNonSpace(is)) != ':') throw json_parser_error("Expected ':' for property value", c);
-      object.set(fieldName, parse(is));
-      c = getNonSpace(is);
-      if (c == ',')
-        continue;
-      if (c == '}')
-        break;
-      throw json_parser_error("Expected '}' or ',' in object", c);
-    }
-    return object;
+bool Reader::readBoolean()
+{
+  if (m_text.substr(m_position).starts_with("true")) {
+    m_position += 4;
+    return true;
+  } else if (m_text.substr(m_position).starts_with("false")) {
+    m_position += 5;
+    return false;
+  }
+  error(std::string("Unexpected character '") + m_text[m_position] + "'");
+}
+
+std::string_view Reader::readPropertyName()
+{
+  std::string_view name;
+  if (peekNonSpace() == '"') {
+    name = readString();
+  } else {
+    // property names may be left unquoted, in which case they cannot contain spaces nor escapes
+    size_t begin = m_position;
+    while (m_position < m_text.size() && m_text[m_position] != ':' && m_text[m_position] != ' ' && m_text[m_position] != '\t'
+        && m_text[m_position] != '\n' && m_text[m_position] != '\r')
+      m_position++;
+    if (begin == m_position)
+      error("Expected a property name");
+    name = m_text.substr(begin, m_position - begin);
+    m_lastStringEscaped = false;
+  }
+  expect(':', "after a property name");
+  return name;
+}
 
-  } else if(c == '[') {
-    is.get();
-    json::array_type arrayValues;
-    c = peekNonSpace(is);
-    if (c == ']') {
-      is.get();
-      return arrayValues;
+std::string_view Reader::readString()
+{
+  m_position++; // '"'
+  size_t begin = m_position;
+  m_lastStringEscaped = false;
+  while (true) {
+    // skip the longest run of plain characters at once
+    size_t runEnd = m_position;
+    while (runEnd < m_text.size() && m_text[runEnd] != '"' && m_text[runEnd] != '\\' && static_cast<unsigned char>(m_text[runEnd]) >= 0x20)
+      runEnd++;
+    if (m_lastStringEscaped)
+      m_scratch.append(m_text.data() + m_position, runEnd - m_position);
+    m_position = runEnd;
+    if (m_position == m_text.size())
+      error("Unterminated string");
+    char c = m_text[m_position++];
+    if (c == '"')
+      return m_lastStringEscaped ? std::string_view{ m_scratch } : m_text.substr(begin, m_position - 1 - begin);
+    if (c != '\\') {
+      m_position--;
+      error("Unescaped control character in string");
     }
-    while(true) {
-      arrayValues.push_back(parse(is));
-      c = getNonSpace(is);
-      if (c == ',')
-        continue;
-      if (c == ']')
-        break;
-      throw json_parser_error("Expected ']' or ',' in array", c);
+    if (!m_lastStringEscaped) {
+      // first escape sequence, the string is decoded from now on
+      m_lastStringEscaped = true;
+      m_scratch.assign(m_text.data() + begin, m_position - 1 - begin);
     }
-    return arrayValues;
-  } else if(c >= '0' && c <= '9' || c == '-') {
-    json::number_type x;
-    is >> x;
-    return x;
-  } else if (c == '"') {
-    is.get();
-    if(is.peek() == '"') {
-      is.get();
-      return std::string{};
+    if (m_position == m_text.size())
+      error("Unterminated string");
+    switch (char escaped = m_text[m_position++]) {
+    case '"':  m_scratch += '"';  break;
+    case '\\': m_scratch += '\\'; break;
+    case '/':  m_scratch += '/';  break;
+    case 'b':  m_scratch += '\b'; break;
+    case 'f':  m_scratch += '\f'; break;
+    case 'n':  m_scratch += '\n'; break;
+    case 'r':  m_scratch += '\r'; break;
+    case 't':  m_scratch += '\t'; break;
+    case 'u':  appendUtf8(m_scratch, readEscapedCodePoint()); break;
+    default:
+      m_position--;
+      error(std::string("Invalid escape sequence '\\") + escaped + "'");
     }
-    char buf[256];
-    is.get(buf, sizeof(buf), '"');
-    if ((c = getNonSpace(is)) != '"') throw json_parser_error("Expected end-of-string '\"'", c);
-    return std::string(buf);
-  } else if (c == 't') {
-    skipText("true", is);
-    return true;
-  } else if (c == 'f') {
-    skipText("false", is);
-    return false;
+  }
+}
+
+// reads the XXXX of a \uXXXX escape, and the low surrogate that must follow a high surrogate
+char32_t Reader::readEscapedCodePoint()
+{
+  char32_t codePoint = readHex4();
+  if (codePoint >= 0xD800 && codePoint <= 0xDBFF) {
+    if (!m_text.substr(m_position).starts_with("\\u"))
+      error("Expected a low surrogate after a high surrogate");
+    m_position += 2;
+    char32_t lowSurrogate = readHex4();
+    if (lowSurrogate < 0xDC00 || lowSurrogate > 0xDFFF)
+      error("Invalid low surrogate");
+    codePoint = 0x10000 + ((codePoint - 0xD800) << 10) + (lowSurrogate - 0xDC00);
+  } else if (codePoint >= 0xDC00 && codePoint <= 0xDFFF) {
+    error("Unexpected low surrogate");
+  }
+  return codePoint;
+}
+
+char32_t Reader::readHex4()
+{
+  if (m_text.size() - m_position < 4)
+    error("Unterminated \\u escape sequence");
+  uint16_t value;
+  auto [end, ec] = std::from_chars(m_text.data() + m_position, m_text.data() + m_position + 4, value, 16);
+  if (ec != std::errc{} || end != m_text.data() + m_position + 4)
+    error("Invalid \\u escape sequence");
+  m_position += 4;
+  return value;
+}
+
+void Reader::appendUtf8(std::string &string, char32_t codePoint)
+{
+  if (codePoint < 0x80) {
+    string += static_cast<char>(codePoint);
+  } else if (codePoint < 0x800) {
+    string += static_cast<char>(0xC0 | (codePoint >> 6));
+    string += static_cast<char>(0x80 | (codePoint & 0x3F));
+  } else if (codePoint < 0x10000) {
+    string += static_cast<char>(0xE0 | (codePoint >> 12));
+    string += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+    string += static_cast<char>(0x80 | (codePoint & 0x3F));
   } else {
-    throw json_parser_error("Unknown json type from begining char " + std::to_string(c));
+    string += static_cast<char>(0xF0 | (codePoint >> 18));
+    string += static_cast<char>(0x80 | ((codePoint >> 12) & 0x3F));
+    string += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+    string += static_cast<char>(0x80 | (codePoint & 0x3F));
   }
 }
 
-}
\ No newline at end of file
+static JsonValue readValue(Reader &reader, size_t depth)
+{
+  switch (reader.peekValue(depth)) {
+  case Reader::TokenType::OBJECT: {
+    JsonObject object;
+    reader.beginObject();
+    for (bool first = true; reader.nextObjectField(first); first = false) {
+      std::string fieldName{ reader.readPropertyName() };
+      object.set(fieldName, readValue(reader, depth+1));
+    }
+    return object;
+  }
+  case Reader::TokenType::ARRAY: {
+    array_type array;
+    reader.beginArray();
+    for (bool first = true; reader.nextArrayElement(first); first = false)
+      array.push_back(readValue(reader, depth+1));
+    return array;
+  }
+  case Reader::TokenType::STRING:
+    return std::string{ reader.readString() };
+  case Reader::TokenType::NUMBER:
+    return reader.readNumber();
+  case Reader::TokenType::BOOLEAN:
+  default:
+    return reader.readBoolean();
+  }
+}
+
+JsonValue parse(std::string_view text)
+{
+  Reader reader{ text };
+  JsonValue value = readValue(reader, 0);
+  reader.expectEnd();
+  return value;
+}
+
+JsonValue parseFile(const std::filesystem::path &filepath)
+{
+  pbl::MappedFile file;
+  try {
+    file = pbl::MappedFile{ filepath };
+  } catch (const std::runtime_error &) {
+    throw std::runtime_error("Could not open json file " + filepath.string());
+  }
+  std::span<const std::byte> bytes = file.getBytes();
+  return parse(std::string_view{ reinterpret_cast<const char *>(bytes.data()), bytes.size() });
+}
+
+JsonValue parse(std::istream &is)
+{
+  std::string text{ std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>() };
+  return parse(text);
+}
+
+}
@@ -4,6 +4,7 @@
 #include <memory>
 #include <stdexcept>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <variant>
 #include <vector>
@@ -12,12 +13,14 @@
 #include "utils/debug.h"
 
 /*
- * Generic JSON parser, there is little (no) error logging but the
- * parser is still safe. By discarding error reporting facilities
- * the parser can be made blazingly fast.
+ * Generic JSON parser. Documents are parsed from a contiguous buffer (files
+ * are memory-mapped), strings may be of any length and contain escape
+ * sequences, errors are reported with their line and column.
  *
  * JsonObject can be copied but copy should be avoided whenever
- * possible. Deep json copy is not cheap.
+ * possible. Deep json copy is not cheap. Large documents that are only
+ * read should be parsed as a JsonDocument instead, see json_document.h,
+ * which only indexes their structure and decodes numbers when accessed.
  */
 
 class JsonObject;
@@ -32,7 +35,7 @@ using variant_type = std::variant<double, JsonObject, array_type, std::string, b
 // boolalpha is used as a workarround because we cannot create new stream flags. We handle "true" and "false" oursleves anyway
 static constexpr auto pretty_format = std::boolalpha;
 
-JsonValue parse(const std::string &text);
+JsonValue parse(std::string_view text);
 JsonValue parseFile(const std::filesystem::path &filepath);
 JsonValue parse(std::istream &is);
 
@@ -107,6 +110,12 @@ private:
 struct json_parser_error : std::runtime_error {
   explicit json_parser_error(const std::string& message) : std::runtime_error(message) {}
   json_parser_error(const std::string &message, char problematicChar) : json_parser_error(message + ", got: " + std::to_string(problematicChar)) {}
+  json_parser_error(const std::string &message, size_t line, size_t column)
+    : std::runtime_error(message + " at line " + std::to_string(line) + ", column " + std::to_string(column))
+    , line(line), column(column) {}
+
+  size_t line = 0; // 1-based, 0 if unknown
+  size_t column = 0;
 };
 
 
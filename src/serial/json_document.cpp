@@ -0,0 +1,186 @@
+#include "json_document.h"
+
+#include <algorithm>
+#include <cstring>
+#include <span>
+
+#include "json_reader.h"
+
+/*
+ * Builds the tape of a document. Fields and elements are pushed on stacks
+ * while their container is being read, because nested containers would
+ * otherwise interleave with them, and are moved to the document at once
+ * when the container is closed.
+ */
+class JsonDocument::Builder
+{
+public:
+  Builder(JsonDocument &document)
+    : m_document(document), m_reader(document.m_text)
+  {}
+
+  void build()
+  {
+    if (m_document.m_text.size() > UINT32_MAX / 2)
+      m_reader.error("Json document is too large");
+    readValue(0);
+    m_reader.expectEnd();
+  }
+
+private:
+  uint32_t readValue(size_t depth)
+  {
+    uint32_t nodeIndex = static_cast<uint32_t>(m_document.m_nodes.size());
+    Node &node = m_document.m_nodes.emplace_back();
+    switch (m_reader.peekValue(depth)) {
+    case json::Reader::TokenType::OBJECT:
+      node.type = Type::OBJECT;
+      readObject(nodeIndex, depth);
+      break;
+    case json::Reader::TokenType::ARRAY:
+      node.type = Type::ARRAY;
+      readArray(nodeIndex, depth);
+      break;
+    case json::Reader::TokenType::STRING: {
+      StringRef string = storeString(m_reader.readString());
+      node.type = Type::STRING;
+      node.size = string.size;
+      node.stringOffset = string.offset;
+      break;
+    }
+    case json::Reader::TokenType::NUMBER: {
+      std::string_view number = m_reader.skipNumber();
+      node.type = Type::NUMBER;
+      node.size = static_cast<uint32_t>(number.size());
+      node.stringOffset = static_cast<uint32_t>(number.data() - m_document.m_text.data());
+      break;
+    }
+    case json::Reader::TokenType::BOOLEAN:
+      node.type = Type::BOOLEAN;
+      node.boolean = m_reader.readBoolean();
+      break;
+    }
+    return nodeIndex;
+  }
+
+  // nodes may be reallocated while the container is read, they are accessed by index
+  void readObject(uint32_t nodeIndex, size_t depth)
+  {
+    size_t stackBegin = m_fieldsStack.size();
+    m_reader.beginObject();
+    for (bool first = true; m_reader.nextObjectField(first); first = false) {
+      StringRef name = storeString(m_reader.readPropertyName());
+      m_fieldsStack.push_back({ name, readValue(depth+1) });
+    }
+    std::span<Field> fields = std::span{ m_fieldsStack }.subspan(stackBegin);
+    sortFields(fields);
+    Node &node = m_document.m_nodes[nodeIndex];
+    node.first = static_cast<uint32_t>(m_document.m_fields.size());
+    node.size = static_cast<uint32_t>(fields.size());
+    m_document.m_fields.insert(m_document.m_fields.end(), fields.begin(), fields.end());
+    m_fieldsStack.resize(stackBegin);
+  }
+
+  void readArray(uint32_t nodeIndex, size_t depth)
+  {
+    size_t stackBegin = m_elementsStack.size();
+    m_reader.beginArray();
+    for (bool first = true; m_reader.nextArrayElement(first); first = false)
+      m_elementsStack.push_back(readValue(depth+1));
+    Node &node = m_document.m_nodes[nodeIndex];
+    node.first = static_cast<uint32_t>(m_document.m_elements.size());
+    node.size = static_cast<uint32_t>(m_elementsStack.size() - stackBegin);
+    m_document.m_elements.insert(m_document.m_elements.end(), m_elementsStack.begin() + stackBegin, m_elementsStack.end());
+    m_elementsStack.resize(stackBegin);
+  }
+
+  StringRef storeString(std::string_view string)
+  {
+    if (!m_reader.wasLastStringEscaped())
+      return { static_cast<uint32_t>(string.data() - m_document.m_text.data()), static_cast<uint32_t>(string.size()) };
+    size_t offset = m_document.m_text.size() + m_document.m_decodedStrings.size();
+    if (offset + string.size() > UINT32_MAX)
+      m_reader.error("Json document is too large");
+    m_document.m_decodedStrings.append(string);
+    return { static_cast<uint32_t>(offset), static_cast<uint32_t>(string.size()) };
+  }
+
+  // objects are small, an insertion sort avoids the allocations of std::stable_sort
+  void sortFields(std::span<Field> fields) const
+  {
+    auto nameOf = [&](const Field &field) { return m_document.getString(field.name); };
+    if (fields.size() > 32) {
+      std::ranges::stable_sort(fields, std::less{}, nameOf);
+      return;
+    }
+    for (size_t i = 1; i < fields.size(); i++) {
+      Field field = fields[i];
+      std::string_view name = nameOf(field);
+      size_t j = i;
+      for (; j > 0 && name < nameOf(fields[j-1]); j--)
+        fields[j] = fields[j-1];
+      fields[j] = field;
+    }
+  }
+
+private:
+  JsonDocument         &m_document;
+  json::Reader          m_reader;
+  std::vector<Field>    m_fieldsStack;
+  std::vector<uint32_t> m_elementsStack;
+};
+
+JsonDocument JsonDocument::parse(std::string_view text)
+{
+  JsonDocument document;
+  document.m_ownedText = std::make_unique_for_overwrite<char[]>(text.size());
+  std::memcpy(document.m_ownedText.get(), text.data(), text.size());
+  document.build({ document.m_ownedText.get(), text.size() });
+  return document;
+}
+
+JsonDocument JsonDocument::parseFile(const std::filesystem::path &filepath)
+{
+  JsonDocument document;
+  try {
+    document.m_file = pbl::MappedFile{ filepath };
+  } catch (const std::runtime_error &) {
+    throw std::runtime_error("Could not open json file " + filepath.string());
+  }
+  std::span<const std::byte> bytes = document.m_file.getBytes();
+  document.build({ reinterpret_cast<const char *>(bytes.data()), bytes.size() });
+  return document;
+}
+
+void JsonDocument::build(std::string_view text)
+{
+  m_text = text;
+  // a rough guess from typical level files, avoids most reallocations
+  m_nodes.reserve(text.size() / 16);
+  Builder{ *this }.build();
+}
+
+void JsonValueRef::throwTypeError(std::string_view fieldName) const
+{
+  static constexpr const char *TYPE_NAMES[] = { "number", "boolean", "string", "object", "array" };
+  std::string valueName = fieldName.empty() ? "json value" : "json field " + std::string(fieldName);
+  throw json_access_error("Invalid type for " + valueName + ", got " + TYPE_NAMES[static_cast<size_t>(getType())]);
+}
+
+std::optional<JsonValueRef> JsonObjectRef::find(std::string_view name) const
+{
+  const JsonDocument::Node &node = m_document->m_nodes[m_node];
+  auto fields = std::span{ m_document->m_fields }.subspan(node.first, node.size);
+  auto field = std::ranges::lower_bound(fields, name, std::less{}, [&](const JsonDocument::Field &f) { return m_document->getString(f.name); });
+  if (field == fields.end() || m_document->getString(field->name) != name)
+    return std::nullopt;
+  return JsonValueRef{ m_document, field->value };
+}
+
+JsonValueRef JsonObjectRef::at(std::string_view name) const
+{
+  std::optional<JsonValueRef> value = find(name);
+  if (!value)
+    throw json_access_error("Missing field in json: " + std::string(name));
+  return *value;
+}
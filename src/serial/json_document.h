@@ -0,0 +1,325 @@
+#pragma once
+
+#include <charconv>
+#include <cstdint>
+#include <filesystem>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "utils/mapped_file.h"
+
+class JsonDocument;
+class JsonValueRef;
+class JsonObjectRef;
+class JsonArrayRef;
+
+/*
+ * Thrown when accessing a field that does not exist or a value with the
+ * wrong type in a JsonDocument.
+ */
+struct json_access_error : std::runtime_error {
+  explicit json_access_error(const std::string &message) : std::runtime_error(message) {}
+};
+
+/*
+ * A json value of a JsonDocument. Values are lightweight views that are
+ * passed by copy, they are valid as long as their document is alive and
+ * has not been moved.
+ */
+class JsonValueRef {
+public:
+  enum class Type : uint8_t { NUMBER, BOOLEAN, STRING, OBJECT, ARRAY };
+
+  JsonValueRef(const JsonDocument *document, uint32_t node)
+    : m_document(document), m_node(node) {}
+
+  Type getType() const;
+  bool isNumber() const { return getType() == Type::NUMBER; }
+  bool isBool() const { return getType() == Type::BOOLEAN; }
+  bool isString() const { return getType() == Type::STRING; }
+  bool isObject() const { return getType() == Type::OBJECT; }
+  bool isArray() const { return getType() == Type::ARRAY; }
+
+  double asNumber() const { return as<double>(); }
+  bool asBool() const { return as<bool>(); }
+  std::string_view asString() const { return as<std::string_view>(); }
+  JsonObjectRef asObject() const;
+  JsonArrayRef asArray() const;
+  // T may be any arithmetic type, std::string_view, JsonObjectRef or JsonArrayRef
+  template<class T>
+  T as() const;
+  template<class T>
+  bool is() const;
+
+private:
+  friend class JsonObjectRef;
+  [[noreturn]] void throwTypeError(std::string_view fieldName) const;
+
+private:
+  const JsonDocument *m_document;
+  uint32_t            m_node;
+};
+
+/*
+ * A json object of a JsonDocument, fields are sorted by name and looked up
+ * by binary search. With duplicated names the first field is kept.
+ */
+class JsonObjectRef {
+public:
+  JsonObjectRef(const JsonDocument *document, uint32_t node)
+    : m_document(document), m_node(node) {}
+
+  double getNumber(std::string_view name) const { return get<double>(name); }
+  int getInt(std::string_view name) const { return get<int>(name); }
+  float getFloat(std::string_view name) const { return get<float>(name); }
+  double getDouble(std::string_view name) const { return get<double>(name); }
+  std::string_view getString(std::string_view name) const { return get<std::string_view>(name); }
+  bool getBool(std::string_view name) const { return get<bool>(name); }
+  JsonObjectRef getObject(std::string_view name) const { return get<JsonObjectRef>(name); }
+  JsonArrayRef getArray(std::string_view name) const;
+  template<class T>
+  T get(std::string_view name) const;
+  // returns the fallback if the field does not exist, throws if it exists with another type
+  template<class T>
+  T getOr(std::string_view name, T fallback) const;
+
+  std::optional<JsonValueRef> find(std::string_view name) const;
+  JsonValueRef at(std::string_view name) const;
+  bool hasField(std::string_view name) const { return find(name).has_value(); }
+  size_t size() const;
+
+private:
+  const JsonDocument *m_document;
+  uint32_t            m_node;
+};
+
+/*
+ * A json array of a JsonDocument, elements are accessed in constant time.
+ */
+class JsonArrayRef {
+public:
+  class iterator {
+  public:
+    using iterator_concept = std::forward_iterator_tag;
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = JsonValueRef;
+    using difference_type = std::ptrdiff_t;
+
+    iterator() = default;
+    iterator(const JsonDocument *document, const uint32_t *element)
+      : m_document(document), m_element(element) {}
+
+    JsonValueRef operator*() const { return { m_document, *m_element }; }
+    iterator &operator++() { m_element++; return *this; }
+    iterator operator++(int) { iterator it = *this; m_element++; return it; }
+    bool operator==(const iterator &other) const { return m_element == other.m_element; }
+
+  private:
+    const JsonDocument *m_document = nullptr;
+    const uint32_t     *m_element = nullptr;
+  };
+
+  JsonArrayRef(const JsonDocument *document, uint32_t node)
+    : m_document(document), m_node(node) {}
+
+  size_t size() const;
+  bool empty() const { return size() == 0; }
+  JsonValueRef operator[](size_t index) const;
+  // decodes the elements, which must all be numbers, into a destination of the size of the array
+  template<class T, size_t Extent>
+    requires std::is_arithmetic_v<T> and (!std::is_same_v<T, bool>)
+  void readNumbers(std::span<T, Extent> destination) const;
+  iterator begin() const;
+  iterator end() const;
+
+private:
+  const JsonDocument *m_document;
+  uint32_t            m_node;
+};
+
+/*
+ * A json document parsed into a single flat tape, an alternative to the
+ * JsonValue tree for large documents (level files).
+ *
+ * All values are nodes of one array, objects and arrays reference ranges of
+ * the fields and elements arrays, so parsing a document makes a handful of
+ * allocations and destroying it walks none. Strings are views into the
+ * source, which the document keeps alive (files are memory-mapped), only
+ * strings with escape sequences are decoded and copied. Numbers are only
+ * validated while parsing, they are decoded from the source each time they
+ * are accessed (floats directly, not through a double).
+ *
+ * The document must not be moved while values are being read from it,
+ * values are accessed through JsonValueRef, JsonObjectRef and JsonArrayRef.
+ */
+class JsonDocument {
+public:
+  using Type = JsonValueRef::Type;
+
+  static JsonDocument parse(std::string_view text);
+  static JsonDocument parseFile(const std::filesystem::path &filepath);
+
+  JsonDocument(JsonDocument &&) noexcept = default;
+  JsonDocument &operator=(JsonDocument &&) noexcept = default;
+
+  JsonValueRef getRoot() const { return { this, 0 }; }
+
+private:
+  friend class JsonValueRef;
+  friend class JsonObjectRef;
+  friend class JsonArrayRef;
+  class Builder;
+
+  // strings are stored as offsets into the source, or past its end into the decoded strings
+  struct StringRef {
+    uint32_t offset;
+    uint32_t size;
+  };
+
+  struct Node {
+    Type     type;
+    uint32_t size; // length of strings and numbers, fields or elements count of objects and arrays
+    union {
+      bool     boolean;
+      uint32_t stringOffset; // offset of the text of strings and numbers, see getString
+      uint32_t first;        // index of the first field or element
+    };
+  };
+
+  struct Field {
+    StringRef name;
+    uint32_t  value;
+  };
+
+  JsonDocument() = default;
+  void build(std::string_view text);
+  template<class T>
+  T decodeNumber(const Node &node) const;
+  std::string_view getString(StringRef string) const
+  {
+    return string.offset < m_text.size()
+      ? m_text.substr(string.offset, string.size)
+      : std::string_view{ m_decodedStrings }.substr(string.offset - m_text.size(), string.size);
+  }
+
+private:
+  pbl::MappedFile         m_file;
+  std::unique_ptr<char[]> m_ownedText;
+  std::string_view        m_text;           // the source, in m_file or m_ownedText
+  std::string             m_decodedStrings; // strings that had escape sequences
+  std::vector<Node>       m_nodes;          // m_nodes[0] is the root
+  std::vector<Field>      m_fields;         // fields of each object, sorted by name
+  std::vector<uint32_t>   m_elements;       // nodes of the elements of each array
+};
+
+inline JsonValueRef::Type JsonValueRef::getType() const
+{
+  return m_document->m_nodes[m_node].type;
+}
+
+inline JsonObjectRef JsonValueRef::asObject() const { return as<JsonObjectRef>(); }
+inline JsonArrayRef JsonValueRef::asArray() const { return as<JsonArrayRef>(); }
+
+template<class T>
+bool JsonValueRef::is() const
+{
+  if constexpr (std::is_same_v<T, bool>)
+    return getType() == Type::BOOLEAN;
+  else if constexpr (std::is_arithmetic_v<T>)
+    return getType() == Type::NUMBER;
+  else if constexpr (std::is_same_v<T, std::string_view>)
+    return getType() == Type::STRING;
+  else if constexpr (std::is_same_v<T, JsonObjectRef>)
+    return getType() == Type::OBJECT;
+  else if constexpr (std::is_same_v<T, JsonArrayRef>)
+    return getType() == Type::ARRAY;
+  else
+    static_assert(!sizeof(T), "Unsupported json value type");
+}
+
+template<class T>
+T JsonValueRef::as() const
+{
+  if (!is<T>())
+    throwTypeError({});
+  const JsonDocument::Node &node = m_document->m_nodes[m_node];
+  if constexpr (std::is_same_v<T, bool>)
+    return node.boolean;
+  else if constexpr (std::is_arithmetic_v<T>)
+    return m_document->decodeNumber<T>(node);
+  else if constexpr (std::is_same_v<T, std::string_view>)
+    return m_document->getString({ node.stringOffset, node.size });
+  else
+    return T{ m_document, m_node };
+}
+
+template<class T>
+T JsonDocument::decodeNumber(const Node &node) const
+{
+  // numbers were validated by the parser, only their range can be invalid
+  using decoded_type = std::conditional_t<std::is_same_v<T, float>, float, double>;
+  std::string_view text = m_text.substr(node.stringOffset, node.size);
+  decoded_type number;
+  if (std::from_chars(text.data(), text.data() + text.size(), number).ec != std::errc{})
+    throw json_access_error("Json number out of range: " + std::string(text));
+  return static_cast<T>(number);
+}
+
+inline JsonArrayRef JsonObjectRef::getArray(std::string_view name) const { return get<JsonArrayRef>(name); }
+
+template<class T>
+T JsonObjectRef::get(std::string_view name) const
+{
+  JsonValueRef value = at(name);
+  if (!value.is<T>())
+    value.throwTypeError(name);
+  return value.as<T>();
+}
+
+template<class T>
+T JsonObjectRef::getOr(std::string_view name, T fallback) const
+{
+  std::optional<JsonValueRef> value = find(name);
+  if (!value)
+    return fallback;
+  if (!value->is<T>())
+    value->throwTypeError(name);
+  return value->as<T>();
+}
+
+inline size_t JsonObjectRef::size() const { return m_document->m_nodes[m_node].size; }
+
+inline size_t JsonArrayRef::size() const { return m_document->m_nodes[m_node].size; }
+
+inline JsonValueRef JsonArrayRef::operator[](size_t index) const
+{
+  return { m_document, m_document->m_elements[m_document->m_nodes[m_node].first + index] };
+}
+
+inline JsonArrayRef::iterator JsonArrayRef::begin() const
+{
+  return { m_document, m_document->m_elements.data() + m_document->m_nodes[m_node].first };
+}
+
+inline JsonArrayRef::iterator JsonArrayRef::end() const
+{
+  return { m_document, m_document->m_elements.data() + m_document->m_nodes[m_node].first + size() };
+}
+
+template<class T, size_t Extent>
+  requires std::is_arithmetic_v<T> and (!std::is_same_v<T, bool>)
+void JsonArrayRef::readNumbers(std::span<T, Extent> destination) const
+{
+  if (destination.size() != size())
+    throw json_access_error("Json array has " + std::to_string(size()) + " elements, expected " + std::to_string(destination.size()));
+  const uint32_t *elements = m_document->m_elements.data() + m_document->m_nodes[m_node].first;
+  for (size_t i = 0; i < destination.size(); i++)
+    destination[i] = JsonValueRef{ m_document, elements[i] }.as<T>();
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+#include "json.h"
+
+namespace json
+{
+
+/*
+ * Reads the tokens of a json document held in a contiguous buffer, shared
+ * by the parsers of JsonValue and JsonDocument which only differ by what
+ * they build. The position of the reader is only converted to a line and
+ * a column when an error is raised, see json_parser_error.
+ */
+class Reader
+{
+public:
+  // deeper documents are rejected instead of overflowing the stack
+  static constexpr size_t MAX_DEPTH = 512;
+
+  enum class TokenType { OBJECT, ARRAY, STRING, NUMBER, BOOLEAN };
+
+  explicit Reader(std::string_view text);
+
+  [[noreturn]] void error(const std::string &message) const;
+
+  // returns the type of the next value, without consuming it
+  TokenType peekValue(size_t depth);
+  // throws if anything but spaces is left after the document
+  void expectEnd();
+
+  // consume the opening character of an object or an array
+  void beginObject() { m_position++; }
+  void beginArray() { m_position++; }
+  // returns false if the container is closed (and consumes the closing character),
+  // call before each element, with first set for the first one
+  bool nextObjectField(bool first) { return nextElement(first, '}', "Expected '}' or ',' in object"); }
+  bool nextArrayElement(bool first) { return nextElement(first, ']', "Expected ']' or ',' in array"); }
+
+  double readNumber();
+  // reads a number without decoding it, returns its text
+  std::string_view skipNumber();
+  bool readBoolean();
+  /*
+   * Reads a string with its escape sequences decoded. The returned view
+   * points into the document if the string had no escape sequence, into a
+   * scratch buffer valid until the next read otherwise.
+   */
+  std::string_view readString();
+  // reads a property name (quoted or not) and the ':' that follows it, see readString
+  std::string_view readPropertyName();
+  // whether the last string read had escape sequences, in which case it does not point into the document
+  bool wasLastStringEscaped() const { return m_lastStringEscaped; }
+
+private:
+  void skipSpaces();
+  char peekNonSpace();
+  void expect(char expected, const char *context);
+  bool nextElement(bool first, char closingChar, const char *errorMessage);
+  char32_t readEscapedCodePoint();
+  char32_t readHex4();
+  static void appendUtf8(std::string &string, char32_t codePoint);
+
+private:
+  std::string_view m_text;
+  size_t           m_position = 0;
+  bool             m_lastStringEscaped = false;
+  std::string      m_scratch; // decoded strings that had escape sequences
+};
+
+}
@@ -0,0 +1,133 @@
+#include "json_writer.h"
+
+#include "utils/debug.h"
+
+JsonWriter::JsonWriter(std::ostream &out, bool pretty)
+  : m_out(out)
+  , m_pretty(pretty)
+{
+  m_buffer.reserve(FLUSH_SIZE + 1024);
+}
+
+JsonWriter::~JsonWriter()
+{
+  // the stream reports write errors, not the writer
+  m_out.write(m_buffer.data(), m_buffer.size());
+}
+
+void JsonWriter::flush()
+{
+  m_out.write(m_buffer.data(), m_buffer.size());
+  m_buffer.clear();
+}
+
+void JsonWriter::newLine()
+{
+  if (!m_pretty) return;
+  m_buffer += '\n';
+  m_buffer.append(m_scopes.size() * 2, ' ');
+}
+
+void JsonWriter::beginValue()
+{
+  if (m_afterKey) {
+    m_afterKey = false;
+    return;
+  }
+  PBL_ASSERT(m_scopes.empty() || m_scopes.back() == '[', "Missing key for a json object field");
+  PBL_ASSERT(!m_scopes.empty() || !m_hasElements, "Multiple json root values");
+  if (m_hasElements)
+    m_buffer += ',';
+  if (!m_scopes.empty())
+    newLine();
+}
+
+void JsonWriter::endValue()
+{
+  m_hasElements = true;
+  if (m_buffer.size() >= FLUSH_SIZE)
+    flush();
+}
+
+void JsonWriter::beginScope(char openingChar)
+{
+  beginValue();
+  m_buffer += openingChar;
+  m_scopes += openingChar;
+  m_hasElements = false;
+}
+
+void JsonWriter::endScope([[maybe_unused]] char openingChar, char closingChar)
+{
+  PBL_ASSERT(!m_scopes.empty() && m_scopes.back() == openingChar && !m_afterKey, "Unbalanced json scopes");
+  m_scopes.pop_back();
+  if (m_hasElements)
+    newLine();
+  m_buffer += closingChar;
+  endValue();
+}
+
+void JsonWriter::beginObject() { beginScope('{'); }
+void JsonWriter::endObject() { endScope('{', '}'); }
+void JsonWriter::beginArray() { beginScope('['); }
+void JsonWriter::endArray() { endScope('[', ']'); }
+
+void JsonWriter::key(std::string_view name)
+{
+  PBL_ASSERT(!m_scopes.empty() && m_scopes.back() == '{' && !m_afterKey, "Json key outside of an object");
+  if (m_hasElements)
+    m_buffer += ',';
+  newLine();
+  writeString(name);
+  m_buffer += m_pretty ? ": " : ":";
+  m_afterKey = true;
+}
+
+void JsonWriter::value(std::string_view string)
+{
+  beginValue();
+  writeString(string);
+  endValue();
+}
+
+void JsonWriter::writeString(std::string_view string)
+{
+  m_buffer += '"';
+  while (!string.empty()) {
+    // copy the longest run of characters that need no escaping at once
+    size_t run = 0;
+    while (run < string.size() && string[run] != '"' && string[run] != '\\' && static_cast<unsigned char>(string[run]) >= 0x20)
+      run++;
+    m_buffer.append(string.substr(0, run));
+    if (run == string.size())
+      break;
+    switch (char c = string[run]) {
+    case '"':  m_buffer += "\\\""; break;
+    case '\\': m_buffer += "\\\\"; break;
+    case '\n': m_buffer += "\\n"; break;
+    case '\r': m_buffer += "\\r"; break;
+    case '\t': m_buffer += "\\t"; break;
+    default:
+      constexpr char hexDigits[] = "0123456789abcdef";
+      m_buffer += "\\u00";
+      m_buffer += hexDigits[c >> 4];
+      m_buffer += hexDigits[c & 0xF];
+    }
+    string.remove_prefix(run + 1);
+  }
+  m_buffer += '"';
+}
+
+void JsonWriter::value(bool boolean)
+{
+  beginValue();
+  m_buffer += boolean ? "true" : "false";
+  endValue();
+}
+
+void JsonWriter::writeNumber(const char *begin, const char *end)
+{
+  beginValue();
+  m_buffer.append(begin, end);
+  endValue();
+}
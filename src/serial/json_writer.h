@@ -0,0 +1,85 @@
+#pragma once
+
+#include <charconv>
+#include <cmath>
+#include <iterator>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+/*
+ * Streaming json writer, values are written as they come without building
+ * a document first. Output is buffered and flushed by chunks to the
+ * underlying stream, numbers are written with std::to_chars (the shortest
+ * representation that reads back to the same value).
+ *
+ * Calls must form a valid document: inside an object every value must be
+ * preceded by a key. Nesting errors are only checked in debug builds.
+ * Non-finite numbers cannot be represented in json and throw.
+ */
+class JsonWriter
+{
+public:
+  explicit JsonWriter(std::ostream &out, bool pretty=false);
+  ~JsonWriter();
+
+  JsonWriter(const JsonWriter &) = delete;
+  JsonWriter &operator=(const JsonWriter &) = delete;
+
+  void beginObject();
+  void endObject();
+  void beginArray();
+  void endArray();
+  void key(std::string_view name);
+
+  void value(std::string_view string);
+  void value(const char *string) { value(std::string_view{ string }); }
+  void value(bool boolean);
+  template<class T>
+    requires std::is_arithmetic_v<T> and (!std::is_same_v<T, bool>)
+  void value(T number);
+
+  template<class T>
+  void field(std::string_view name, const T &fieldValue) { key(name); value(fieldValue); }
+
+  // writes the buffered output to the stream, done when the writer is destroyed
+  void flush();
+
+private:
+  static constexpr size_t FLUSH_SIZE = 64 * 1024;
+
+  void beginValue();
+  void endValue();
+  void beginScope(char openingChar);
+  void endScope(char openingChar, char closingChar);
+  void newLine();
+  void writeNumber(const char *begin, const char *end);
+  void writeString(std::string_view string);
+
+private:
+  std::ostream &m_out;
+  std::string   m_buffer;
+  std::string   m_scopes;           // opening characters of the objects and arrays being written
+  bool          m_pretty;
+  bool          m_hasElements = false; // whether the current scope has a value already
+  bool          m_afterKey = false;
+};
+
+template<class T>
+  requires std::is_arithmetic_v<T> and (!std::is_same_v<T, bool>)
+void JsonWriter::value(T number)
+{
+  // large enough for any double in its shortest form
+  char chars[32];
+  std::to_chars_result result;
+  if constexpr (std::is_floating_point_v<T>) {
+    if (!std::isfinite(number))
+      throw std::runtime_error("Cannot write a non-finite number in json");
+    result = std::to_chars(std::begin(chars), std::end(chars), number);
+  } else {
+    result = std::to_chars(std::begin(chars), std::end(chars), +number); // + promotes chars to integers
+  }
+  writeNumber(chars, result.ptr);
+}
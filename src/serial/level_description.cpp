@@ -0,0 +1,620 @@
+#include "level_description.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <utility>
+
+#include "json_document.h"
+#include "json_writer.h"
+#include "utils/mapped_file.h"
+#include "utils/parallel.h"
+
+namespace pbl
+{
+
+namespace
+{
+
+struct CookedHeader {
+  uint32_t magic = LevelDescription::COOKED_MAGIC;
+  uint32_t version = LevelDescription::COOKED_VERSION;
+  uint32_t objectsCount = 0;
+  uint32_t objectsOffset = 0; // offsets are in bytes, from the start of the file
+  uint32_t dataOffset = 0;
+  uint32_t dataSize = 0;
+};
+
+struct CookedObject {
+  uint32_t type;   // index in LevelObjectDescription::variant_type
+  uint32_t offset; // from the start of the data
+  uint32_t size;
+};
+
+// values copied as they are in memory, vec3 are not as only 3 of their components are meaningful
+template<class T>
+concept is_raw_cooked_v = std::is_arithmetic_v<T>
+  or std::is_same_v<T, rvec2>
+  or std::is_same_v<T, rvec3>
+  or std::is_same_v<T, rvec4>;
+
+class CookedWriter
+{
+public:
+  explicit CookedWriter(std::string &data) : m_data(data) {}
+
+  template<class T>
+    requires is_raw_cooked_v<T>
+  void write(const T &value)
+  {
+    m_data.append(reinterpret_cast<const char *>(&value), sizeof(T));
+  }
+
+  template<class T>
+    requires has_serial_fields<T>
+  void write(const T &value)
+  {
+    std::apply([&](const auto &...fields) { (write(value.*fields.member), ...); }, T::fields());
+  }
+
+  template<class T>
+  void write(const std::vector<T> &values)
+  {
+    writeSize(values.size());
+    for (const T &value : values)
+      write(value);
+  }
+
+  template<class T>
+  void write(const std::optional<T> &value)
+  {
+    write(value.has_value());
+    if (value) write(*value);
+  }
+
+  void write(const std::string &string)
+  {
+    writeSize(string.size());
+    m_data.append(string);
+  }
+
+  void write(const vec3 &vector)
+  {
+    rvec3 components;
+    XMStoreFloat3(&components, vector);
+    write(components);
+  }
+
+  void write(const Transform &transform)
+  {
+    write(transform.position);
+    write(transform.scale);
+    rvec4 rotation;
+    XMStoreFloat4(&rotation, transform.rotation);
+    write(rotation);
+  }
+
+  void write(const BezierCurve &curve)
+  {
+    writeSize(curve.controlPoints.size());
+    for (const BezierControlPoint &controlPoint : curve.controlPoints) {
+      write(controlPoint.position);
+      write(controlPoint.handleLeft);
+      write(controlPoint.handleRight);
+    }
+    write(curve.isLoop);
+  }
+
+  void write(const BezierCurveFile &curveFile)
+  {
+    write(curveFile.file);
+    write(curveFile.curve);
+  }
+
+private:
+  void writeSize(size_t size)
+  {
+    if (size > UINT32_MAX)
+      throw std::runtime_error("Level too large to be cooked");
+    write(static_cast<uint32_t>(size));
+  }
+
+private:
+  std::string &m_data;
+};
+
+class CookedReader
+{
+public:
+  explicit CookedReader(std::span<const std::byte> data) : m_data(data) {}
+
+  template<class T>
+    requires is_raw_cooked_v<T>
+  void read(T &value)
+  {
+    readBytes(&value, sizeof(T));
+  }
+
+  // bytes other than 0 and 1 are not valid bools, they cannot be copied as they are
+  void read(bool &value)
+  {
+    uint8_t byte;
+    read(byte);
+    if (byte > 1)
+      throw std::runtime_error("Corrupted cooked level");
+    value = byte != 0;
+  }
+
+  template<class T>
+    requires has_serial_fields<T>
+  void read(T &value)
+  {
+    std::apply([&](const auto &...fields) { (read(value.*fields.member), ...); }, T::fields());
+  }
+
+  template<class T>
+  void read(std::vector<T> &values)
+  {
+    values.resize(readSize());
+    for (T &value : values)
+      read(value);
+  }
+
+  template<class T>
+  void read(std::optional<T> &value)
+  {
+    bool hasValue;
+    read(hasValue);
+    if (hasValue) read(value.emplace());
+  }
+
+  void read(std::string &string)
+  {
+    string.resize(readSize());
+    readBytes(string.data(), string.size());
+  }
+
+  void read(vec3 &vector)
+  {
+    rvec3 components;
+    read(components);
+    vector = XMLoadFloat3(&components);
+  }
+
+  void read(Transform &transform)
+  {
+    rvec3 position, scale;
+    rvec4 rotation;
+    read(position);
+    read(scale);
+    read(rotation);
+    // same w components as transforms read from json
+    transform.position = XMVectorSetW(XMLoadFloat3(&position), 1.f);
+    transform.scale = XMLoadFloat3(&scale);
+    transform.rotation = XMLoadFloat4(&rotation);
+  }
+
+  void read(BezierCurve &curve)
+  {
+    curve.controlPoints.resize(readSize());
+    for (BezierControlPoint &controlPoint : curve.controlPoints) {
+      read(controlPoint.position);
+      read(controlPoint.handleLeft);
+      read(controlPoint.handleRight);
+    }
+    read(curve.isLoop);
+  }
+
+  void read(BezierCurveFile &curveFile)
+  {
+    read(curveFile.file);
+    read(curveFile.curve);
+  }
+
+private:
+  void readBytes(void *destination, size_t size)
+  {
+    if (size > m_data.size() - m_position)
+      throw std::runtime_error("Corrupted cooked level");
+    std::memcpy(destination, m_data.data() + m_position, size);
+    m_position += size;
+  }
+
+  // sizes are checked against the remaining data before anything is allocated
+  size_t readSize()
+  {
+    uint32_t size;
+    read(size);
+    if (size > m_data.size() - m_position)
+      throw std::runtime_error("Corrupted cooked level");
+    return size;
+  }
+
+private:
+  std::span<const std::byte> m_data;
+  size_t                     m_position = 0;
+};
+
+// default-constructs the alternative of index type and passes it to func
+template<class Func, size_t ...Types>
+LevelObjectDescription::variant_type makeObjectOfType(size_t type, Func &&func, std::index_sequence<Types...>)
+{
+  LevelObjectDescription::variant_type object;
+  bool found = ((type == Types ? (func(object.template emplace<Types>()), true) : false) || ...);
+  if (!found)
+    throw std::runtime_error("Unknown level object type " + std::to_string(type));
+  return object;
+}
+
+template<class Func>
+LevelObjectDescription::variant_type makeObjectOfType(size_t type, Func &&func)
+{
+  return makeObjectOfType(type, func, std::make_index_sequence<std::variant_size_v<LevelObjectDescription::variant_type>>{});
+}
+
+/*
+ * Json codecs. Values are read from and written to named fields, values
+ * stored as json objects (types with serial fields, vectors, transforms)
+ * can also be read from and written to the object being read or written.
+ * All overloads are declared first, templates find them at instantiation.
+ */
+
+template<class T> requires has_serial_fields<T>
+void readJsonObject(const JsonObjectRef &object, T &value);
+void readJsonObject(const JsonObjectRef &object, vec3 &vector);
+void readJsonObject(const JsonObjectRef &object, Transform &transform);
+template<class T>
+void readJsonValue(const JsonObjectRef &object, const char *name, T &value);
+template<class T> requires std::is_arithmetic_v<T>
+void readJsonValue(const JsonObjectRef &object, const char *name, T &value);
+template<class T>
+void readJsonValue(const JsonObjectRef &object, const char *name, std::optional<T> &value);
+template<class T>
+void readJsonValue(const JsonObjectRef &object, const char *name, std::vector<T> &values);
+void readJsonValue(const JsonObjectRef &object, const char *name, std::string &string);
+void readJsonValue(const JsonObjectRef &object, const char *name, BezierCurveFile &curveFile);
+
+template<class T> requires has_serial_fields<T>
+void writeJsonObject(JsonWriter &writer, const T &value);
+void writeJsonObject(JsonWriter &writer, const vec3 &vector);
+void writeJsonObject(JsonWriter &writer, const Transform &transform);
+template<class T>
+void writeJsonValue(JsonWriter &writer, const char *name, const T &value);
+template<class T> requires std::is_arithmetic_v<T>
+void writeJsonValue(JsonWriter &writer, const char *name, const T &value);
+template<class T>
+void writeJsonValue(JsonWriter &writer, const char *name, const std::optional<T> &value);
+template<class T>
+void writeJsonValue(JsonWriter &writer, const char *name, const std::vector<T> &values);
+void writeJsonValue(JsonWriter &writer, const char *name, const std::string &string);
+void writeJsonValue(JsonWriter &writer, const char *name, const BezierCurveFile &curveFile);
+
+template<class T> requires has_serial_fields<T>
+void readJsonObject(const JsonObjectRef &object, T &value)
+{
+  auto readField = [&]<class Field>(const Field &field) {
+    if constexpr (requires { field.name; })
+      readJsonValue(object, field.name, value.*field.member);
+    else
+      readJsonObject(object, value.*field.member);
+  };
+  std::apply([&](const auto &...fields) { (readField(fields), ...); }, T::fields());
+}
+
+void readJsonObject(const JsonObjectRef &object, vec3 &vector)
+{
+  vector = vec3{ object.getFloat("x"), object.getFloat("y"), object.getFloat("z") };
+}
+
+void readJsonObject(const JsonObjectRef &object, Transform &transform)
+{
+  rvec4 p{ object.getOr("x", 0.f), object.getOr("y", 0.f), object.getOr("z", 0.f), 1 };
+  rvec4 s{ object.getOr("w", 1.f), object.getOr("h", 1.f), object.getOr("d", 1.f), 0 };
+  rvec4 q{ object.getOr("qx", 0.f), object.getOr("qy", 0.f), object.getOr("qz", 0.f), object.getOr("qw", 1.f) };
+  transform = Transform{ XMLoadFloat4(&p), XMLoadFloat4(&s), XMLoadFloat4(&q) };
+}
+
+template<class T>
+void readJsonValue(const JsonObjectRef &object, const char *name, T &value)
+{
+  readJsonObject(object.getObject(name), value);
+}
+
+template<class T> requires std::is_arithmetic_v<T>
+void readJsonValue(const JsonObjectRef &object, const char *name, T &value)
+{
+  value = object.get<T>(name);
+}
+
+template<class T>
+void readJsonValue(const JsonObjectRef &object, const char *name, std::optional<T> &value)
+{
+  if (object.hasField(name))
+    readJsonValue(object, name, value.emplace());
+}
+
+template<class T>
+void readJsonValue(const JsonObjectRef &object, const char *name, std::vector<T> &values)
+{
+  JsonArrayRef array = object.getArray(name);
+  if constexpr (std::is_arithmetic_v<T>) {
+    values.resize(array.size());
+    array.readNumbers(std::span{ values });
+  } else {
+    values.reserve(array.size());
+    for (JsonValueRef element : array)
+      readJsonObject(element.asObject(), values.emplace_back());
+  }
+}
+
+void readJsonValue(const JsonObjectRef &object, const char *name, std::string &string)
+{
+  string = object.getString(name);
+}
+
+void readJsonValue(const JsonObjectRef &object, const char *name, BezierCurveFile &curveFile)
+{
+  curveFile.file = object.getString(name);
+  curveFile.curve = BezierCurve::loadFromFile(curveFile.file);
+}
+
+template<class T> requires has_serial_fields<T>
+void writeJsonObject(JsonWriter &writer, const T &value)
+{
+  auto writeField = [&]<class Field>(const Field &field) {
+    if constexpr (requires { field.name; })
+      writeJsonValue(writer, field.name, value.*field.member);
+    else
+      writeJsonObject(writer, value.*field.member);
+  };
+  std::apply([&](const auto &...fields) { (writeField(fields), ...); }, T::fields());
+}
+
+void writeJsonObject(JsonWriter &writer, const vec3 &vector)
+{
+  writer.field("x", XMVectorGetX(vector));
+  writer.field("y", XMVectorGetY(vector));
+  writer.field("z", XMVectorGetZ(vector));
+}
+
+// only the components that differ from the identity transform are written
+void writeJsonObject(JsonWriter &writer, const Transform &transform)
+{
+  rvec3 p{};
+  rvec3 s{};
+  rvec4 q{};
+  XMStoreFloat3(&p, transform.position);
+  XMStoreFloat3(&s, transform.scale);
+  XMStoreFloat4(&q, transform.rotation);
+  if (p.x != 0.f) writer.field("x", p.x);
+  if (p.y != 0.f) writer.field("y", p.y);
+  if (p.z != 0.f) writer.field("z", p.z);
+  if (s.x != 1.f) writer.field("w", s.x);
+  if (s.y != 1.f) writer.field("h", s.y);
+  if (s.z != 1.f) writer.field("d", s.z);
+  if (q.x != 0.f) writer.field("qx", q.x);
+  if (q.y != 0.f) writer.field("qy", q.y);
+  if (q.z != 0.f) writer.field("qz", q.z);
+  if (q.w != 1.f) writer.field("qw", q.w);
+}
+
+template<class T>
+void writeJsonValue(JsonWriter &writer, const char *name, const T &value)
+{
+  writer.key(name);
+  writer.beginObject();
+  writeJsonObject(writer, value);
+  writer.endObject();
+}
+
+template<class T> requires std::is_arithmetic_v<T>
+void writeJsonValue(JsonWriter &writer, const char *name, const T &value)
+{
+  writer.field(name, value);
+}
+
+template<class T>
+void writeJsonValue(JsonWriter &writer, const char *name, const std::optional<T> &value)
+{
+  if (value)
+    writeJsonValue(writer, name, *value);
+}
+
+template<class T>
+void writeJsonValue(JsonWriter &writer, const char *name, const std::vector<T> &values)
+{
+  writer.key(name);
+  writer.beginArray();
+  for (const T &value : values) {
+    if constexpr (std::is_arithmetic_v<T>) {
+      writer.value(value);
+    } else {
+      writer.beginObject();
+      writeJsonObject(writer, value);
+      writer.endObject();
+    }
+  }
+  writer.endArray();
+}
+
+void writeJsonValue(JsonWriter &writer, const char *name, const std::string &string)
+{
+  writer.field(name, string);
+}
+
+void writeJsonValue(JsonWriter &writer, const char *name, const BezierCurveFile &curveFile)
+{
+  BezierCurve::writeToFile(curveFile.file, curveFile.curve);
+  writer.field(name, curveFile.file);
+}
+
+}
+
+static LevelObjectDescription readLevelObject(const JsonObjectRef &object)
+{
+  std::string_view type = object.getString("type");
+  auto typeName = std::ranges::find(LevelObjectDescription::TYPE_NAMES, type);
+  if (typeName == std::end(LevelObjectDescription::TYPE_NAMES))
+    throw std::runtime_error("Unknown object type in level file: " + std::string(type));
+
+  LevelObjectDescription description;
+  description.object = makeObjectOfType(typeName - std::begin(LevelObjectDescription::TYPE_NAMES), [&](auto &typedObject) { readJsonObject(object, typedObject); });
+  description.ref = object.getOr("ref", std::string_view{});
+  if (std::optional<JsonValueRef> layer = object.find("layer"))
+    description.layer = static_cast<layer_t>(layer->as<int>());
+  // the layer of a track selects its texture, it cannot be omitted
+  else if (std::holds_alternative<TrackDescription>(description.object))
+    object.at("layer");
+  return description;
+}
+
+static void writeLevelObject(JsonWriter &writer, const LevelObjectDescription &description)
+{
+  writer.beginObject();
+  writer.field("type", description.getTypeName());
+  if (!description.ref.empty())
+    writer.field("ref", description.ref);
+  if (description.layer)
+    writer.field("layer", *description.layer);
+  std::visit([&](const auto &typedObject) { writeJsonObject(writer, typedObject); }, description.object);
+  writer.endObject();
+}
+
+// a cooked level embeds curves, it is out of date if one of their files changed since it was cooked
+static bool areCookedCurvesUpToDate(const LevelDescription &level, std::filesystem::file_time_type cookTime)
+{
+  auto isUpToDate = [&](const std::string &curveFile) {
+    std::error_code error;
+    return std::filesystem::last_write_time(curveFile, error) <= cookTime || error;
+  };
+  return std::ranges::all_of(level.objects, [&](const LevelObjectDescription &object) {
+    if (const auto *track = std::get_if<TrackDescription>(&object.object))
+      return isUpToDate(track->bezier.file);
+    if (const auto *gameLogic = std::get_if<GameLogicDescription>(&object.object))
+      return isUpToDate(gameLogic->postEndTrack.file);
+    return true;
+  });
+}
+
+std::filesystem::path LevelDescription::getCookedFilePath(const std::filesystem::path &levelFile)
+{
+  return std::filesystem::path{ levelFile }.replace_extension(".cooked");
+}
+
+LevelDescription LevelDescription::load(const std::filesystem::path &levelFile)
+{
+  std::filesystem::path cookedFilePath = getCookedFilePath(levelFile);
+  std::error_code cookedError, sourceError;
+  std::filesystem::file_time_type cookTime = std::filesystem::last_write_time(cookedFilePath, cookedError);
+  std::filesystem::file_time_type sourceTime = std::filesystem::last_write_time(levelFile, sourceError);
+  // a cooked level can be shipped without its source
+  if (!cookedError && (sourceError || cookTime >= sourceTime)) {
+    try {
+      MappedFile cookedFile{ cookedFilePath };
+      LevelDescription level = readCooked(cookedFile.getBytes());
+      if (areCookedCurvesUpToDate(level, cookTime))
+        return level;
+    } catch (const std::runtime_error &) {
+      // fallback to the json source, the cooked file is replaced below
+    }
+  }
+
+  LevelDescription level = readJson(levelFile);
+  try {
+    std::ofstream out{ cookedFilePath, std::ios::binary };
+    level.writeCooked(out);
+  } catch (const std::runtime_error &) {
+    // the level directory may be read-only, the level will be read from json again next time
+  }
+  return level;
+}
+
+
+LevelDescription LevelDescription::readJson(const std::filesystem::path &levelFile)
+{
+  JsonDocument document = JsonDocument::parseFile(levelFile);
+  JsonArrayRef serializedObjects = document.getRoot().asObject().getArray("objects");
+  LevelDescription level;
+  // the document is only read, objects are decoded independently (with their curve files)
+  level.objects.resize(serializedObjects.size());
+  utils::parallelFor(level.objects.size(), [&](size_t i) {
+    level.objects[i] = readLevelObject(serializedObjects[i].asObject());
+  });
+  return level;
+}
+
+LevelDescription LevelDescription::readCooked(std::span<const std::byte> data)
+{
+  CookedHeader header;
+  if (data.size() < sizeof(header))
+    throw std::runtime_error("Corrupted cooked level");
+  std::memcpy(&header, data.data(), sizeof(header));
+  if (header.magic != COOKED_MAGIC)
+    throw std::runtime_error("Not a cooked level");
+  if (header.version != COOKED_VERSION)
+    throw std::runtime_error("Unsupported cooked level version " + std::to_string(header.version));
+  if (header.objectsOffset > data.size() || header.objectsCount > (data.size() - header.objectsOffset) / sizeof(CookedObject)
+   || header.dataOffset > data.size() || header.dataSize > data.size() - header.dataOffset)
+    throw std::runtime_error("Corrupted cooked level");
+
+  std::span<const std::byte> objectsData = data.subspan(header.dataOffset, header.dataSize);
+  LevelDescription level;
+  level.objects.resize(header.objectsCount);
+  utils::parallelFor(level.objects.size(), [&](size_t i) {
+    CookedObject cookedObject;
+    std::memcpy(&cookedObject, data.data() + header.objectsOffset + i * sizeof(CookedObject), sizeof(CookedObject));
+    if (cookedObject.offset > objectsData.size() || cookedObject.size > objectsData.size() - cookedObject.offset)
+      throw std::runtime_error("Corrupted cooked level");
+    CookedReader reader{ objectsData.subspan(cookedObject.offset, cookedObject.size) };
+    LevelObjectDescription &object = level.objects[i];
+    reader.read(object.ref);
+    reader.read(object.layer);
+    object.object = makeObjectOfType(cookedObject.type, [&](auto &typedObject) { reader.read(typedObject); });
+  });
+  return level;
+}
+
+void LevelDescription::writeJson(std::ostream &out) const
+{
+  JsonWriter writer{ out, true };
+  writer.beginObject();
+  writer.key("objects");
+  writer.beginArray();
+  for (const LevelObjectDescription &object : objects)
+    writeLevelObject(writer, object);
+  writer.endArray();
+  writer.endObject();
+}
+
+void LevelDescription::writeCooked(std::ostream &out) const
+{
+  std::string data;
+  std::vector<CookedObject> cookedObjects;
+  cookedObjects.reserve(objects.size());
+  CookedWriter writer{ data };
+  for (const LevelObjectDescription &object : objects) {
+    size_t offset = data.size();
+    writer.write(object.ref);
+    writer.write(object.layer);
+    std::visit([&](const auto &typedObject) { writer.write(typedObject); }, object.object);
+    cookedObjects.push_back({ static_cast<uint32_t>(object.object.index()), static_cast<uint32_t>(offset), static_cast<uint32_t>(data.size() - offset) });
+  }
+
+  CookedHeader header;
+  header.objectsCount = static_cast<uint32_t>(cookedObjects.size());
+  header.objectsOffset = sizeof(CookedHeader);
+  size_t dataOffset = header.objectsOffset + cookedObjects.size() * sizeof(CookedObject);
+  if (dataOffset + data.size() > UINT32_MAX)
+    throw std::runtime_error("Level too large to be cooked");
+  header.dataOffset = static_cast<uint32_t>(dataOffset);
+  header.dataSize = static_cast<uint32_t>(data.size());
+
+  out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  out.write(reinterpret_cast<const char *>(cookedObjects.data()), cookedObjects.size() * sizeof(CookedObject));
+  out.write(data.data(), data.size());
+  if (!out)
+    throw std::runtime_error("Could not write a cooked level");
+}
+
+}
@@ -0,0 +1,214 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <iterator>
+#include <optional>
+#include <ostream>
+#include <span>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <variant>
+#include <vector>
+
+#include "scene/game/track.h"
+#include "serial_fields.h"
+#include "utils/bezier_curve.h"
+#include "world/object.h"
+#include "world/terrain.h"
+#include "world/transform.h"
+
+namespace pbl
+{
+
+/*
+ * Descriptions of the objects of a level, as read from a level file.
+ * Descriptions only hold data, GameSerializer instantiates the objects and
+ * describes the objects of the editor. Their serialized fields are listed
+ * by fields(), see SerialField.
+ */
+
+// a bezier curve and the file it is stored in, json files only reference the file
+struct BezierCurveFile {
+  std::string file;
+  BezierCurve curve;
+};
+
+struct TrackDescription {
+  BezierCurveFile                     bezier;
+  std::vector<Track::AttractionPoint> attractionPoints;
+  Track::TrackProfileTemplate         profile;
+
+  static constexpr auto fields()
+  {
+    return std::make_tuple(
+      SerialField{ "bezier_file",       &TrackDescription::bezier           },
+      SerialField{ "attraction_points", &TrackDescription::attractionPoints },
+      SerialField{ "profile",           &TrackDescription::profile          });
+  }
+};
+
+struct TerrainDescription {
+  TerrainSettings          settings;
+  std::string              heightmapFile;
+  std::optional<Transform> transform;
+
+  static constexpr auto fields()
+  {
+    return std::make_tuple(
+      SerialField{ "settings",       &TerrainDescription::settings      },
+      SerialField{ "heightmap_file", &TerrainDescription::heightmapFile },
+      SerialField{ "transform",      &TerrainDescription::transform     });
+  }
+};
+
+struct PropDescription {
+  std::string              modelFile;
+  std::string              shaderFile;
+  std::optional<Transform> transform;
+
+  static constexpr auto fields()
+  {
+    return std::make_tuple(
+      SerialField{ "model_file",  &PropDescription::modelFile  },
+      SerialField{ "shader_file", &PropDescription::shaderFile },
+      SerialField{ "transform",   &PropDescription::transform  });
+  }
+};
+
+struct TriggerBoxDescription {
+  Transform transform;
+
+  static constexpr auto fields()
+  {
+    return std::make_tuple(SerialField{ "transform", &TriggerBoxDescription::transform });
+  }
+};
+
+struct GameLogicDescription {
+  Transform       playerSpawn;
+  BezierCurveFile postEndTrack;
+  vec3            endCameraOffset;
+
+  static constexpr auto fields()
+  {
+    return std::make_tuple(
+      SerialField{ "player_spawn",        &GameLogicDescription::playerSpawn     },
+      SerialField{ "post_end_track_file", &GameLogicDescription::postEndTrack    },
+      SerialField{ "end_camera_offset",   &GameLogicDescription::endCameraOffset });
+  }
+};
+
+struct BillboardsDescription {
+  struct Billboard {
+    std::string texture;
+    vec3        position;
+    float       width, height;
+    float       texX, texY, texW, texH;
+
+    static constexpr auto fields()
+    {
+      return std::make_tuple(
+        SerialField{ "texture", &Billboard::texture },
+        InlinedSerialField{ &Billboard::position },
+        SerialField{ "w",  &Billboard::width  },
+        SerialField{ "h",  &Billboard::height },
+        SerialField{ "tx", &Billboard::texX   },
+        SerialField{ "ty", &Billboard::texY   },
+        SerialField{ "tw", &Billboard::texW   },
+        SerialField{ "th", &Billboard::texH   });
+    }
+  };
+
+  std::vector<Billboard> billboards;
+
+  static constexpr auto fields()
+  {
+    return std::make_tuple(SerialField{ "billboards", &BillboardsDescription::billboards });
+  }
+};
+
+struct CameraRailDescription {
+  std::vector<vec3> points;
+
+  static constexpr auto fields()
+  {
+    return std::make_tuple(SerialField{ "points", &CameraRailDescription::points });
+  }
+};
+
+struct TunnelDescription {
+  std::optional<Transform> transform;
+
+  static constexpr auto fields()
+  {
+    return std::make_tuple(SerialField{ "transform", &TunnelDescription::transform });
+  }
+};
+
+struct LevelObjectDescription {
+  // the index of a type is its id in cooked files, appending types does not break existing files
+  using variant_type = std::variant<
+    TrackDescription,
+    TerrainDescription,
+    PropDescription,
+    TriggerBoxDescription,
+    GameLogicDescription,
+    BillboardsDescription,
+    CameraRailDescription,
+    TunnelDescription>;
+  // names of the types in json files, in the variant's order
+  static constexpr const char *TYPE_NAMES[] = { "track", "terrain", "prop", "triggerbox", "gamelogic", "billboard", "camerarail", "tunnel" };
+  static_assert(std::size(TYPE_NAMES) == std::variant_size_v<variant_type>);
+
+  std::string            ref; // empty if the object is not referenced
+  std::optional<layer_t> layer;
+  variant_type           object;
+
+  const char *getTypeName() const { return TYPE_NAMES[object.index()]; }
+
+  // index of a description type in variant_type
+  template<class T>
+  static constexpr size_t getTypeId()
+  {
+    return []<class ...Ts>(std::variant<Ts...> *) {
+      size_t index = 0;
+      ((std::is_same_v<T, Ts> ? false : (index++, true)) && ...);
+      return index;
+    }(static_cast<variant_type *>(nullptr));
+  }
+
+  template<class T>
+  static constexpr const char *getTypeName() { return TYPE_NAMES[getTypeId<T>()]; }
+};
+
+/*
+ * The content of a level file, read from its json source or from its
+ * cooked form.
+ *
+ * A cooked level is a binary file next to the json file: a header, a table
+ * of typed objects and their raw payloads, bezier curves included. It is
+ * loaded without any text parsing. The json file stays the editable source
+ * of truth, its cooked file is only used while it is more recent than the
+ * json file and the curve files it embeds. Levels are cooked when saved
+ * from the editor and when they are loaded from their json source.
+ */
+struct LevelDescription {
+  static constexpr uint32_t COOKED_MAGIC = 0x564C4250; // "PBLV"
+  static constexpr uint32_t COOKED_VERSION = 1;
+
+  std::vector<LevelObjectDescription> objects;
+
+  static std::filesystem::path getCookedFilePath(const std::filesystem::path &levelFile);
+  // reads the cooked level if it is up to date, the json source otherwise (and cooks it)
+  static LevelDescription load(const std::filesystem::path &levelFile);
+  static LevelDescription readJson(const std::filesystem::path &levelFile);
+  static LevelDescription readCooked(std::span<const std::byte> data);
+  // also writes the files of the bezier curves
+  void writeJson(std::ostream &out) const;
+  void writeCooked(std::ostream &out) const;
+};
+
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <tuple>
+
+namespace pbl
+{
+
+/*
+ * Descriptors of the serialized fields of a class. A serialized class lists
+ * its fields in a static fields() function returning a tuple of descriptors,
+ * from which level files are read and written (see level_description.cpp):
+ * by name in json files, in the order of the list in cooked files.
+ */
+template<class Owner, class T>
+struct SerialField {
+  const char *name; // name in json objects
+  T Owner::*member;
+};
+
+// a field whose own fields are serialized in the json object of its owner
+template<class Owner, class T>
+struct InlinedSerialField {
+  T Owner::*member;
+};
+
+template<class T>
+concept has_serial_fields = requires { T::fields(); };
+
+}
@@ -0,0 +1,119 @@
+#include "static_props_index.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <ranges>
+#include <sstream>
+
+namespace pbl
+{
+
+// precedes the baked tree in baked files, its size keeps the tree aligned on 16 bytes
+struct BakedPropsHeader {
+  static constexpr uint32_t MAGIC = 0x50534250; // "PBSP"
+
+  uint32_t magic = MAGIC;
+  uint32_t propsCount = 0;
+  float    minY = 0;
+  float    maxY = 0;
+};
+static_assert(sizeof(BakedPropsHeader) % alignof(QuadTreeSubregions) == 0);
+
+struct IndexedPropRegionMapper {
+  const std::vector<QuadTreeRegion> *regions;
+  QuadTreeRegion operator()(size_t propIndex) const { return (*regions)[propIndex]; }
+};
+
+static void bakeProps(std::ostream &out, std::span<const StaticPropsIndex::IndexedProp> props)
+{
+  std::vector<QuadTreeRegion> regions;
+  regions.reserve(props.size());
+  QuadTreeRegion spanningRegion{};
+  BakedPropsHeader header;
+  header.propsCount = static_cast<uint32_t>(props.size());
+  for (const StaticPropsIndex::IndexedProp &prop : props) {
+    AABB boundingBox = prop.prop->getWorldBoundingBox();
+    rvec3 origin, size;
+    XMStoreFloat3(&origin, boundingBox.getOrigin());
+    XMStoreFloat3(&size, boundingBox.getSize());
+    const QuadTreeRegion &region = regions.emplace_back(QuadTreeRegion{ origin.x, origin.z, origin.x + size.x, origin.z + size.z });
+    bool first = regions.size() == 1;
+    spanningRegion = first ? region : QuadTreeRegion{
+      std::min(spanningRegion.minX, region.minX), std::min(spanningRegion.minY, region.minY),
+      std::max(spanningRegion.maxX, region.maxX), std::max(spanningRegion.maxY, region.maxY) };
+    header.minY = first ? origin.y : std::min(header.minY, origin.y);
+    header.maxY = first ? origin.y + size.y : std::max(header.maxY, origin.y + size.y);
+  }
+  FlatQuadTree<size_t, IndexedPropRegionMapper> tree{ spanningRegion, IndexedPropRegionMapper{ &regions } };
+  tree.rebuild(std::views::iota(size_t{ 0 }, props.size()));
+  out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  BakedQuadTree::write(out, tree, [&](size_t propIndex) { return props[propIndex].id; });
+}
+
+std::filesystem::path StaticPropsIndex::getBakedFilePath(const std::filesystem::path &levelFile)
+{
+  return std::filesystem::path{ levelFile }.replace_extension(".qtree");
+}
+
+void StaticPropsIndex::writeBakedFile(const std::filesystem::path &levelFile, std::span<const IndexedProp> props)
+{
+  std::ofstream out{ getBakedFilePath(levelFile), std::ios::binary };
+  bakeProps(out, props);
+}
+
+void StaticPropsIndex::load(const std::filesystem::path &levelFile, std::vector<std::shared_ptr<WorldObject>> &&levelObjects, std::span<const IndexedProp> props)
+{
+  m_props.assign(levelObjects.size(), nullptr);
+  for (const IndexedProp &prop : props)
+    m_props[prop.id] = std::move(levelObjects[prop.id]);
+  m_tree = {};
+  m_bakedFile = {};
+  m_builtTree.clear();
+
+  std::filesystem::path bakedFilePath = getBakedFilePath(levelFile);
+  std::error_code bakedError, sourceError;
+  std::filesystem::file_time_type bakeTime = std::filesystem::last_write_time(bakedFilePath, bakedError);
+  std::filesystem::file_time_type sourceTime = std::filesystem::last_write_time(levelFile, sourceError);
+  // a level can be shipped without its source, see LevelDescription::load
+  if (!bakedError && (sourceError || bakeTime >= sourceTime)) {
+    try {
+      m_bakedFile = MappedFile{ bakedFilePath };
+      openBakedBytes(m_bakedFile.getBytes(), props.size());
+      return;
+    } catch (const std::runtime_error &) {
+      // fallback to an in-memory build
+    }
+    m_tree = {};
+    m_bakedFile = {};
+  }
+
+  std::ostringstream out{ std::ios::binary };
+  bakeProps(out, props);
+  std::string bytes = std::move(out).str();
+  m_builtTree.resize(bytes.size());
+  std::memcpy(m_builtTree.data(), bytes.data(), bytes.size());
+  openBakedBytes(m_builtTree, props.size());
+}
+
+void StaticPropsIndex::openBakedBytes(std::span<const std::byte> bytes, size_t propsCount)
+{
+  // a stale or hand-copied file must not make queries reach past the props
+  BakedPropsHeader header;
+  if (bytes.size() < sizeof(header))
+    throw std::runtime_error("Invalid baked props file");
+  std::memcpy(&header, bytes.data(), sizeof(header));
+  if (header.magic != BakedPropsHeader::MAGIC || header.propsCount != propsCount)
+    throw std::runtime_error("Baked props file does not match the level");
+  BakedQuadTree tree{ bytes.subspan(sizeof(header)) };
+  if (tree.size() != propsCount)
+    throw std::runtime_error("Baked props file does not match the level");
+  for (const BakedQuadTree::Member &member : tree.getMembers())
+    if (member.id >= m_props.size() || m_props[member.id] == nullptr)
+      throw std::runtime_error("Baked props file does not match the level");
+  m_tree = tree;
+  m_minY = header.minY;
+  m_maxY = header.maxY;
+}
+
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <filesystem>
+#include <memory>
+#include <span>
+#include <vector>
+
+#include "display/camera.h"
+#include "utils/mapped_file.h"
+#include "world/baked_quad_tree.h"
+#include "world/object.h"
+
+namespace pbl
+{
+
+/*
+ * A spatial index (on the XZ plane) of the static props of a level.
+ *
+ * The index is baked next to the level file when the level is saved (see
+ * GameSerializer::writeLevelFile) and memory-mapped back when the level is
+ * loaded, instead of being rebuilt from the loaded props. If the baked file
+ * is missing, older than the level file or does not match the level's props,
+ * the index is rebuilt in memory. The baked file starts with a small header
+ * holding the vertical extent of the props, followed by the baked tree.
+ *
+ * Ids stored in the tree are the indices of the props in the level file's
+ * objects array, see getObject. The index owns the props, a scene renders
+ * them through forEachVisibleProp and registers their physics bodies through
+ * forEachProp instead of keeping them with its other objects.
+ */
+class StaticPropsIndex
+{
+public:
+  using id_type = BakedQuadTree::value_type;
+
+  struct IndexedProp {
+    id_type          id;
+    const WorldProp *prop;
+  };
+
+  static std::filesystem::path getBakedFilePath(const std::filesystem::path &levelFile);
+  static void writeBakedFile(const std::filesystem::path &levelFile, std::span<const IndexedProp> props);
+
+  // levelObjects are indexed by id, props must be the level's static props, only the props are kept
+  void load(const std::filesystem::path &levelFile, std::vector<std::shared_ptr<WorldObject>> &&levelObjects, std::span<const IndexedProp> props);
+
+  const BakedQuadTree &getTree() const { return m_tree; }
+  // null if the object with that id is not a static prop
+  const std::shared_ptr<WorldObject> &getObject(id_type id) const { return m_props[id]; }
+  bool isLoadedFromBakedFile() const { return m_bakedFile.isOpen(); }
+
+  // calls visitor(WorldObject &) on every prop, to register their physics bodies for example
+  template<class Visitor>
+  void forEachProp(Visitor &&visitor) const
+  {
+    for (const std::shared_ptr<WorldObject> &prop : m_props)
+      if (prop) visitor(*prop);
+  }
+
+  // calls visitor(WorldObject &) on the props that may be visible in the frustum, see FrustumQuadTreeSearch
+  template<class Visitor>
+  void forEachVisibleProp(const Frustum &frustum, Visitor &&visitor) const
+  {
+    m_tree.forEachInShape(FrustumQuadTreeSearch{ frustum, m_minY, m_maxY }, [&](id_type id) {
+      // ids are checked when the index is loaded, a null prop is never expected here
+      if (m_props[id]) visitor(*m_props[id]);
+    });
+  }
+
+private:
+  // opens a baked file's content, checks that its ids are the ids of props
+  void openBakedBytes(std::span<const std::byte> bytes, size_t propsCount);
+
+private:
+  std::vector<std::shared_ptr<WorldObject>> m_props; // indexed by id
+  MappedFile                                m_bakedFile;
+  std::vector<std::byte>                    m_builtTree; // used instead of the baked file when it is not up to date
+  BakedQuadTree                             m_tree;
+  float                                     m_minY = 0; // vertical extent of the props, the tree only spans XZ
+  float                                     m_maxY = 0;
+};
+
+}
@@ -1,6 +1,92 @@
 ﻿#include "bezier_curve.h"
 
+#include <algorithm>
+#include <array>
 #include <fstream>
+#include <tuple>
+
+#include "debug.h"
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define PBL_BEZIER_SSE
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define PBL_BEZIER_NEON
+#endif
+
+namespace
+{
+
+/*
+ * A segment of a curve in power basis, p(t) = a + t*(b + t*(c + t*d)) and
+ * p'(t) = b + t*(2c + t*3d), coefficients are stored per coordinate.
+ */
+struct PowerBasisSegment {
+  float a[3], b[3], c[3], d[3];
+  float c2[3], d3[3]; // derivative coefficients
+};
+
+std::vector<PowerBasisSegment> toPowerBasis(const std::vector<BezierControlPoint> &controlPoints)
+{
+  std::vector<PowerBasisSegment> segments(controlPoints.size()-1);
+  for (size_t i = 0; i < segments.size(); i++) {
+    rvec3 p0, p1, p2, p3;
+    XMStoreFloat3(&p0, controlPoints[i].position);
+    XMStoreFloat3(&p1, controlPoints[i].handleRight);
+    XMStoreFloat3(&p2, controlPoints[i+1].handleLeft);
+    XMStoreFloat3(&p3, controlPoints[i+1].position);
+    float x0[3]{ p0.x, p0.y, p0.z }, x1[3]{ p1.x, p1.y, p1.z }, x2[3]{ p2.x, p2.y, p2.z }, x3[3]{ p3.x, p3.y, p3.z };
+    PowerBasisSegment &segment = segments[i];
+    for (size_t k = 0; k < 3; k++) {
+      segment.a[k] = x0[k];
+      segment.b[k] = 3*(x1[k] - x0[k]);
+      segment.c[k] = 3*(x0[k] - 2*x1[k] + x2[k]);
+      segment.d[k] = x3[k] - x0[k] + 3*(x1[k] - x2[k]);
+      segment.c2[k] = 2*segment.c[k];
+      segment.d3[k] = 3*segment.d[k];
+    }
+  }
+  return segments;
+}
+
+// the segment of t and the parameter in that segment, clamped as BezierCurve::samplePoint
+std::pair<size_t, float> locateParameter(float t, size_t segmentCount)
+{
+  if (!(t > 0)) return { 0, 0.f };
+  if (t >= static_cast<float>(segmentCount)) return { segmentCount-1, 1.f };
+  size_t segment = static_cast<size_t>(t);
+  return { segment, t - static_cast<float>(segment) };
+}
+
+// 3 points Gauss-Legendre quadrature over -1..1
+constexpr std::array<float, 3> GAUSS_NODES{ -.7745966692f, 0.f, +.7745966692f };
+constexpr std::array<float, 3> GAUSS_WEIGHTS{ 5.f/9.f, 8.f/9.f, 5.f/9.f };
+
+// the length of a curve over an interval of its parameter, from its tangents at the interval's GAUSS_NODES
+float integrateSpeed(std::span<const vec3> nodeTangents, float interval)
+{
+  float length = 0;
+  for (size_t j = 0; j < GAUSS_NODES.size(); j++)
+    length += GAUSS_WEIGHTS[j] * XMVectorGetX(XMVector3Length(nodeTangents[j]));
+  return length * interval * .5f;
+}
+
+#if defined(PBL_BEZIER_SSE)
+using float4 = __m128;
+inline float4 load4(const float *p) { return _mm_load_ps(p); }
+inline void store4(float *p, float4 v) { _mm_store_ps(p, v); }
+inline float4 broadcast4(float v) { return _mm_set1_ps(v); }
+inline float4 multiplyAdd4(float4 a, float4 b, float4 c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+#elif defined(PBL_BEZIER_NEON)
+using float4 = float32x4_t;
+inline float4 load4(const float *p) { return vld1q_f32(p); }
+inline void store4(float *p, float4 v) { vst1q_f32(p, v); }
+inline float4 broadcast4(float v) { return vdupq_n_f32(v); }
+inline float4 multiplyAdd4(float4 a, float4 b, float4 c) { return vmlaq_f32(c, a, b); }
+#endif
+
+}
 
 vec3 BezierCurve::samplePoint(float t) const
 {
@@ -10,6 +96,75 @@ vec3 BezierCurve::samplePoint(float t) const
   return interpolate(controlPoints[ft], controlPoints[ft+1], t-static_cast<float>(ft));
 }
 
+vec3 BezierCurve::sampleTangent(float t) const
+{
+  if (controlPoints.size() < 2) return {};
+  auto [segment, segmentT] = locateParameter(t, controlPoints.size()-1);
+  return interpolateTangent(controlPoints[segment], controlPoints[segment+1], segmentT);
+}
+
+void BezierCurve::evaluate(std::span<const float> parameters, std::span<vec3> points, std::span<vec3> tangents) const
+{
+  PBL_ASSERT(points.size() == parameters.size(), "Invalid points count");
+  PBL_ASSERT(tangents.empty() || tangents.size() == parameters.size(), "Invalid tangents count");
+
+  if (controlPoints.size() < 2) {
+    std::ranges::fill(points, controlPoints.empty() ? vec3{} : controlPoints[0].position);
+    std::ranges::fill(tangents, vec3{});
+    return;
+  }
+
+  std::vector<PowerBasisSegment> segments = toPowerBasis(controlPoints);
+  size_t i = 0;
+
+#if defined(PBL_BEZIER_SSE) || defined(PBL_BEZIER_NEON)
+  for (; i + 4 <= parameters.size(); i += 4) {
+    alignas(16) float ts[4];
+    size_t laneSegments[4];
+    for (size_t lane = 0; lane < 4; lane++)
+      std::tie(laneSegments[lane], ts[lane]) = locateParameter(parameters[i+lane], segments.size());
+
+    // coefficients are broadcast when the parameters share a segment (sorted parameters mostly do), gathered otherwise
+    alignas(16) float a[3][4], b[3][4], c[3][4], d[3][4], c2[3][4], d3[3][4];
+    bool sameSegment = laneSegments[0] == laneSegments[3] && laneSegments[1] == laneSegments[2] && laneSegments[0] == laneSegments[1];
+    for (size_t lane = 0; lane < (sameSegment ? 1 : 4); lane++) {
+      const PowerBasisSegment &segment = segments[laneSegments[lane]];
+      for (size_t k = 0; k < 3; k++) {
+        a[k][lane] = segment.a[k]; b[k][lane] = segment.b[k]; c[k][lane] = segment.c[k]; d[k][lane] = segment.d[k];
+        c2[k][lane] = segment.c2[k]; d3[k][lane] = segment.d3[k];
+      }
+    }
+    auto coefficients = [sameSegment](const float *lanes) { return sameSegment ? broadcast4(lanes[0]) : load4(lanes); };
+
+    float4 t = load4(ts);
+    alignas(16) float p[3][4], dp[3][4];
+    for (size_t k = 0; k < 3; k++) {
+      float4 bk = coefficients(b[k]);
+      store4(p[k], multiplyAdd4(t, multiplyAdd4(t, multiplyAdd4(t, coefficients(d[k]), coefficients(c[k])), bk), coefficients(a[k])));
+      store4(dp[k], multiplyAdd4(t, multiplyAdd4(t, coefficients(d3[k]), coefficients(c2[k])), bk));
+    }
+    for (size_t lane = 0; lane < 4; lane++) {
+      points[i+lane] = vec3{ p[0][lane], p[1][lane], p[2][lane] };
+      if (!tangents.empty())
+        tangents[i+lane] = vec3{ dp[0][lane], dp[1][lane], dp[2][lane] };
+    }
+  }
+#endif
+
+  for (; i < parameters.size(); i++) {
+    auto [segmentIndex, t] = locateParameter(parameters[i], segments.size());
+    const PowerBasisSegment &segment = segments[segmentIndex];
+    float p[3], dp[3];
+    for (size_t k = 0; k < 3; k++) {
+      p[k] = segment.a[k] + t*(segment.b[k] + t*(segment.c[k] + t*segment.d[k]));
+      dp[k] = segment.b[k] + t*(segment.c2[k] + t*segment.d3[k]);
+    }
+    points[i] = vec3{ p[0], p[1], p[2] };
+    if (!tangents.empty())
+      tangents[i] = vec3{ dp[0], dp[1], dp[2] };
+  }
+}
+
 DiscreteCurve BezierCurve::discretize(float delta) const
 {
   DiscreteCurve curve;
@@ -18,41 +173,25 @@ DiscreteCurve BezierCurve::discretize(float delta) const
   return curve;
 }
 
-DiscreteCurve BezierCurve::discretizeEvenly(const EvenDiscretizationSettings &settings) const
+DiscreteCurve BezierCurve::discretizeEvenly(float spacing) const
 {
   DiscreteCurve curve;
 
   if (controlPoints.empty())
     return curve;
 
-  vec3 prevPoint = controlPoints[0].position;
-  vec3 nextPoint;
-  for (float t = 0; t < static_cast<float>(controlPoints.size()); ) {
-    // perform a bisection to find the next anchor point
-    float bisectIntervalMin = t;
-    float bisectIntervalMax = t + settings.binarySearchInitialStep*2.f;
-    t += settings.binarySearchInitialStep;
-    for(int i = 0; i < settings.maxBinarySearchIterations; i++) {
-      nextPoint = samplePoint(t);
-      float dist = XMVectorGetX(XMVector3Length(prevPoint - nextPoint));
-      if (std::abs(dist - settings.targetEvenDistance) < settings.acceptedEvenDistanceDelta)
-        break;
-      if(dist < settings.targetEvenDistance) {
-        bisectIntervalMin = t;
-        t = (t + bisectIntervalMax) * .5f;
-      } else {
-        bisectIntervalMax = t;
-        t = (t + bisectIntervalMin) * .5f;
-      }
-    }
-
-    prevPoint = nextPoint;
-    curve.points.emplace_back(nextPoint);
-  }
+  std::vector<float> parameters = ArcLengthTable(*this).getEvenlySpacedParameters(*this, spacing);
+  curve.points.resize(parameters.size());
+  evaluate(parameters, curve.points);
 
   return curve;
 }
 
+vec3 BezierCurve::sampleAtDistance(const ArcLengthTable &arcLengths, float distance) const
+{
+  return samplePoint(arcLengths.distanceToParameter(*this, distance));
+}
+
 vec3 BezierCurve::interpolate(const BezierControlPoint& c0, const BezierControlPoint& c1, float t)
 {
   // this code could use a nice matrix multiplication
@@ -68,6 +207,16 @@ vec3 BezierCurve::interpolate(const BezierControlPoint& c0, const BezierControlP
   return t0 * p0 + t1 * p1 + t2 * p2 + t3 * p3;
 }
 
+vec3 BezierCurve::interpolateTangent(const BezierControlPoint &c0, const BezierControlPoint &c1, float t)
+{
+  const vec3 &p0 = c0.position;
+  const vec3 &p1 = c0.handleRight;
+  const vec3 &p2 = c1.handleLeft;
+  const vec3 &p3 = c1.position;
+  float q = 1-t;
+  return 3*q*q * (p1 - p0) + 6*q*t * (p2 - p1) + 3*t*t * (p3 - p2);
+}
+
 BezierCurve BezierCurve::loadFromFile(const std::filesystem::path& filePath)
 {
   std::ifstream is{ filePath };
@@ -101,6 +250,105 @@ void BezierCurve::writeToFile(const std::filesystem::path& filePath, const Bezie
   }
 }
 
+ArcLengthTable::ArcLengthTable(const BezierCurve &curve)
+{
+  if (curve.controlPoints.size() < 2)
+    return;
+
+  size_t sampleCount = (curve.controlPoints.size() - 1) * SAMPLES_PER_SEGMENT + 1;
+  std::vector<float> parameters((sampleCount - 1) * GAUSS_NODES.size());
+  for (size_t i = 0; i+1 < sampleCount; i++)
+    for (size_t j = 0; j < GAUSS_NODES.size(); j++)
+      parameters[i*GAUSS_NODES.size() + j] = (static_cast<float>(i) + (1 + GAUSS_NODES[j]) * .5f) / SAMPLES_PER_SEGMENT;
+  std::vector<vec3> points(parameters.size()), tangents(parameters.size());
+  curve.evaluate(parameters, points, tangents);
+
+  m_lengths.resize(sampleCount);
+  m_lengths[0] = 0;
+  for (size_t i = 1; i < sampleCount; i++)
+    m_lengths[i] = m_lengths[i-1] + integrateSpeed(std::span{ tangents }.subspan((i-1) * GAUSS_NODES.size(), GAUSS_NODES.size()), 1.f / SAMPLES_PER_SEGMENT);
+}
+
+float ArcLengthTable::parameterAtSample(size_t sample, float distance) const
+{
+  // distance is in m_lengths[sample-1]..m_lengths[sample]
+  float sampleLength = m_lengths[sample] - m_lengths[sample-1];
+  float k = sampleLength > 0 ? (distance - m_lengths[sample-1]) / sampleLength : 0.f;
+  return (static_cast<float>(sample-1) + k) / SAMPLES_PER_SEGMENT;
+}
+
+void ArcLengthTable::refineParameters(const BezierCurve &curve, std::span<float> parameters, std::span<const float> distances, std::span<const size_t> samples) const
+{
+  // the length up to a parameter is the length up to its sample plus the integral of the speed from the sample,
+  // a Newton step moves the parameter by the length error over the speed at the parameter
+  constexpr size_t NODES_COUNT = GAUSS_NODES.size() + 1;
+  std::vector<float> nodes(parameters.size() * NODES_COUNT);
+  for (size_t i = 0; i < parameters.size(); i++) {
+    float sampleStart = static_cast<float>(samples[i]-1) / SAMPLES_PER_SEGMENT;
+    for (size_t j = 0; j < GAUSS_NODES.size(); j++)
+      nodes[i*NODES_COUNT + j] = sampleStart + (parameters[i] - sampleStart) * (1 + GAUSS_NODES[j]) * .5f;
+    nodes[i*NODES_COUNT + GAUSS_NODES.size()] = parameters[i];
+  }
+  std::vector<vec3> points(nodes.size()), tangents(nodes.size());
+  curve.evaluate(nodes, points, tangents);
+
+  for (size_t i = 0; i < parameters.size(); i++) {
+    float sampleStart = static_cast<float>(samples[i]-1) / SAMPLES_PER_SEGMENT;
+    float sampleEnd = static_cast<float>(samples[i]) / SAMPLES_PER_SEGMENT;
+    std::span<const vec3> nodeTangents = std::span{ tangents }.subspan(i*NODES_COUNT, NODES_COUNT);
+    float length = m_lengths[samples[i]-1] + integrateSpeed(nodeTangents.first(GAUSS_NODES.size()), parameters[i] - sampleStart);
+    float speed = XMVectorGetX(XMVector3Length(nodeTangents.back()));
+    if (speed > 0)
+      parameters[i] = std::clamp(parameters[i] - (length - distances[i]) / speed, sampleStart, sampleEnd);
+  }
+}
+
+float ArcLengthTable::distanceToParameter(const BezierCurve &curve, float distance) const
+{
+  if (m_lengths.empty() || distance <= 0)
+    return 0;
+  if (distance >= getLength())
+    return static_cast<float>(m_lengths.size()-1) / SAMPLES_PER_SEGMENT;
+  size_t sample = std::upper_bound(m_lengths.begin(), m_lengths.end(), distance) - m_lengths.begin();
+  float parameter = parameterAtSample(sample, distance);
+  refineParameters(curve, { &parameter, 1 }, { &distance, 1 }, { &sample, 1 });
+  return parameter;
+}
+
+std::vector<float> ArcLengthTable::getEvenlySpacedParameters(const BezierCurve &curve, float targetSpacing) const
+{
+  std::vector<float> parameters;
+  if (m_lengths.empty())
+    return parameters;
+
+  PBL_ASSERT(targetSpacing > 0, "Evenly spaced parameters need a positive spacing");
+  // clamped before the cast, which is undefined for out of range (or nan) values
+  float intervalsCount = std::round(getLength() / targetSpacing);
+  size_t intervals = intervalsCount >= 1
+    ? static_cast<size_t>(std::min(intervalsCount, static_cast<float>(MAX_EVENLY_SPACED_INTERVALS)))
+    : size_t{ 1 };
+  float spacing = getLength() / static_cast<float>(intervals);
+  parameters.reserve(intervals + 1);
+  parameters.push_back(0);
+  std::vector<float> distances;
+  std::vector<size_t> samples;
+  distances.reserve(intervals);
+  samples.reserve(intervals);
+  // distances are increasing, samples are walked instead of searched
+  size_t sample = 1;
+  for (size_t i = 1; i < intervals; i++) {
+    float distance = spacing * static_cast<float>(i);
+    while (sample < m_lengths.size()-1 && m_lengths[sample] <= distance)
+      sample++;
+    parameters.push_back(parameterAtSample(sample, distance));
+    distances.push_back(distance);
+    samples.push_back(sample);
+  }
+  refineParameters(curve, std::span{ parameters }.subspan(1), distances, samples);
+  parameters.push_back(static_cast<float>(m_lengths.size()-1) / SAMPLES_PER_SEGMENT);
+  return parameters;
+}
+
 vec3 DiscreteCurve::samplePoint(float t) const
 {
   if (t <= 0) return points.front();
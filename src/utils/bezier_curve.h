@@ -1,6 +1,7 @@
 ﻿#pragma once
 
 #include <filesystem>
+#include <span>
 #include <vector>
 
 #include "./math.h"
@@ -39,33 +40,80 @@ struct BezierControlPoint {
   vec3 handleRight{};
 };
 
+struct BezierCurve;
+
+/*
+ * The length of a bezier curve along its parameter, to sample the curve by
+ * distance instead of by parameter. Each segment is sampled at a fixed
+ * number of parameters and the length of the curve up to each sample is
+ * stored, integrated with a Gauss-Legendre quadrature of the curve's speed.
+ * Distances are mapped back to parameters by a search over the samples and
+ * a linear interpolation between the two around the distance, refined by a
+ * Newton step on the curve itself (the parameter speed of a curve varies a
+ * lot within a sample on long segments).
+ * A table is only valid for the curve it was built from, it must be built
+ * again when the curve is modified, and be given that curve.
+ */
+class ArcLengthTable
+{
+public:
+  static constexpr size_t SAMPLES_PER_SEGMENT = 16;
+  static constexpr size_t MAX_EVENLY_SPACED_INTERVALS = 1 << 20;
+
+  ArcLengthTable() = default;
+  explicit ArcLengthTable(const BezierCurve &curve);
+
+  float getLength() const { return m_lengths.empty() ? 0.f : m_lengths.back(); }
+  // the parameter (see BezierCurve::samplePoint) at a distance along the curve, clamped to the curve
+  float distanceToParameter(const BezierCurve &curve, float distance) const;
+  /*
+   * Parameters of points evenly spaced along the curve, from its start to
+   * its end, the spacing is adjusted for the length of the curve to be a
+   * multiple of it. Sampling is linear in the number of points, which is
+   * capped by MAX_EVENLY_SPACED_INTERVALS. targetSpacing must be positive.
+   */
+  std::vector<float> getEvenlySpacedParameters(const BezierCurve &curve, float targetSpacing) const;
+
+private:
+  float parameterAtSample(size_t sample, float distance) const;
+  // parameters[i] must have been found by parameterAtSample(samples[i], distances[i])
+  void refineParameters(const BezierCurve &curve, std::span<float> parameters, std::span<const float> distances, std::span<const size_t> samples) const;
+
+private:
+  std::vector<float> m_lengths; // length up to each sample, SAMPLES_PER_SEGMENT samples per segment and the end
+};
+
 /* A cubic bezier curve */
 struct BezierCurve {
   std::vector<BezierControlPoint> controlPoints;
   bool isLoop = false;
 
-  struct EvenDiscretizationSettings {
-    // binary search settings
-    int   maxBinarySearchIterations = 8;
-    float binarySearchInitialStep = .2f;
-    // world settings (the distance at which two discretized points should be, on average)
-    // depends heavily on your use-case
-    float targetEvenDistance = 2.f;
-    float acceptedEvenDistanceDelta = .1f;
-  };
-
   /*
    * returns interpolate(points[floor(t)], points[floor(t+1)], fract(t))
    * meaning that if points are unevenly distributed samples will not be
    * evenly distanced
    */
   vec3 samplePoint(float t) const;
+  // the derivative of the curve at t, clamped as samplePoint
+  vec3 sampleTangent(float t) const;
+  /*
+   * Batched samplePoint and sampleTangent, points and tangents must have the
+   * size of parameters, tangents may also be empty. Segments are converted
+   * to their power basis once per call and parameters are evaluated by four
+   * with SIMD when available, the single sample functions are the reference.
+   */
+  void evaluate(std::span<const float> parameters, std::span<vec3> points, std::span<vec3> tangents={}) const;
+  // the table must have been built from this curve, see ArcLengthTable
+  vec3 sampleAtDistance(const ArcLengthTable &arcLengths, float distance) const;
+  float distanceToParameter(const ArcLengthTable &arcLengths, float distance) const { return arcLengths.distanceToParameter(*this, distance); }
 
   DiscreteCurve discretize(float delta) const;
-  DiscreteCurve discretizeEvenly(const EvenDiscretizationSettings &settings={}) const;
+  // spacing is the distance between two discretized points, depends heavily on your use-case
+  DiscreteCurve discretizeEvenly(float spacing=2.f) const;
 
   // t must be in range 0..1
   static vec3 interpolate(const BezierControlPoint &c0, const BezierControlPoint &c1, float t);
+  static vec3 interpolateTangent(const BezierControlPoint &c0, const BezierControlPoint &c1, float t);
 
   /*
    * Reads a bezier curve from a text file.
@@ -0,0 +1,106 @@
+#include "mapped_file.h"
+
+#include <stdexcept>
+#include <utility>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace pbl
+{
+
+// empty files are not mapped (neither windows nor posix can map 0 bytes), their data points to this
+// sentinel instead, so that an open empty file is still isOpen() and its bytes have a non-null data()
+static const std::byte EMPTY_FILE_DATA[1]{};
+
+MappedFile::MappedFile(const std::filesystem::path &file)
+{
+  auto fail = [&]() { return std::runtime_error("Could not map file " + file.string()); };
+#ifdef _WIN32
+  HANDLE fileHandle = CreateFileW(file.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (fileHandle == INVALID_HANDLE_VALUE)
+    throw fail();
+  LARGE_INTEGER fileSize;
+  if (!GetFileSizeEx(fileHandle, &fileSize)) {
+    CloseHandle(fileHandle);
+    throw fail();
+  }
+  m_size = static_cast<size_t>(fileSize.QuadPart);
+  if (m_size == 0) {
+    CloseHandle(fileHandle);
+    m_data = EMPTY_FILE_DATA;
+    return;
+  }
+  HANDLE mappingHandle = CreateFileMappingW(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  CloseHandle(fileHandle);
+  if (!mappingHandle)
+    throw fail();
+  // the view keeps the mapping alive
+  m_data = static_cast<const std::byte *>(MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0));
+  CloseHandle(mappingHandle);
+  if (!m_data)
+    throw fail();
+#else
+  int fd = open(file.c_str(), O_RDONLY);
+  if (fd < 0)
+    throw fail();
+  struct stat fileStat;
+  if (fstat(fd, &fileStat) != 0) {
+    ::close(fd);
+    throw fail();
+  }
+  m_size = static_cast<size_t>(fileStat.st_size);
+  if (m_size == 0) {
+    ::close(fd);
+    m_data = EMPTY_FILE_DATA;
+    return;
+  }
+  void *data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (data == MAP_FAILED)
+    throw fail();
+  m_data = static_cast<const std::byte *>(data);
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+  close();
+}
+
+MappedFile::MappedFile(MappedFile &&moved) noexcept
+  : m_data(std::exchange(moved.m_data, nullptr))
+  , m_size(std::exchange(moved.m_size, 0))
+{
+}
+
+MappedFile &MappedFile::operator=(MappedFile &&moved) noexcept
+{
+  if (this != &moved) {
+    close();
+    m_data = std::exchange(moved.m_data, nullptr);
+    m_size = std::exchange(moved.m_size, 0);
+  }
+  return *this;
+}
+
+void MappedFile::close()
+{
+  if (m_data && m_data != EMPTY_FILE_DATA) {
+#ifdef _WIN32
+    UnmapViewOfFile(m_data);
+#else
+    munmap(const_cast<std::byte *>(m_data), m_size);
+#endif
+  }
+  m_data = nullptr;
+  m_size = 0;
+}
+
+}
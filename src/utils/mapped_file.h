@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <span>
+
+namespace pbl
+{
+
+/*
+ * A read-only view of a whole file, mapped in memory.
+ * Pages are loaded by the OS on first access, opening a file does not
+ * read it. Throws std::runtime_error if the file cannot be mapped.
+ */
+class MappedFile
+{
+public:
+  MappedFile() = default;
+  explicit MappedFile(const std::filesystem::path &file);
+  ~MappedFile();
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+  MappedFile(MappedFile &&moved) noexcept;
+  MappedFile &operator=(MappedFile &&moved) noexcept;
+
+  bool isOpen() const { return m_data != nullptr; }
+  std::span<const std::byte> getBytes() const { return { m_data, m_size }; }
+
+private:
+  void close();
+
+private:
+  const std::byte *m_data = nullptr;
+  size_t           m_size = 0;
+};
+
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <algorithm>
+#include <exception>
+#include <execution>
+#include <numeric>
+#include <vector>
+
+namespace utils
+{
+
+/*
+ * Calls work(i) for each i in 0..count on the parallel execution policy,
+ * work must not touch anything shared without synchronization.
+ * An exception escaping a parallel algorithm terminates the program, so
+ * exceptions are caught and the one of the first failing index is rethrown
+ * once all the work is done.
+ */
+template<class F>
+void parallelFor(size_t count, F &&work)
+{
+  std::vector<size_t> indices(count);
+  std::iota(indices.begin(), indices.end(), size_t{ 0 });
+  std::vector<std::exception_ptr> errors(count);
+  std::for_each(std::execution::par, indices.begin(), indices.end(), [&](size_t i) {
+    try {
+      work(i);
+    } catch (...) {
+      errors[i] = std::current_exception();
+    }
+  });
+  for (const std::exception_ptr &error : errors)
+    if (error) std::rethrow_exception(error);
+}
+
+}
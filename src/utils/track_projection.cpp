@@ -0,0 +1,146 @@
+#include "track_projection.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+
+#include "debug.h"
+
+TrackProjectionIndex::TrackProjectionIndex(std::vector<vec3> points, vec3 up)
+  : m_points(std::move(points))
+  , m_up(up)
+{
+  m_distances.reserve(m_points.size());
+  float distance = 0;
+  for (size_t i = 0; i < m_points.size(); i++) {
+    if (i > 0) distance += XMVectorGetX(XMVector3Length(m_points[i] - m_points[i-1]));
+    m_distances.push_back(distance);
+  }
+  if (m_points.size() > 1)
+    buildNode(0, static_cast<uint32_t>(m_points.size() - 1));
+}
+
+uint32_t TrackProjectionIndex::buildNode(uint32_t firstSegment, uint32_t segmentEnd)
+{
+  // the segments of a node span the points firstSegment..segmentEnd included
+  vec3 boundsMin = m_points[firstSegment], boundsMax = m_points[firstSegment];
+  for (uint32_t i = firstSegment+1; i <= segmentEnd; i++) {
+    boundsMin = XMVectorMin(boundsMin, m_points[i]);
+    boundsMax = XMVectorMax(boundsMax, m_points[i]);
+  }
+  uint32_t nodeIndex = static_cast<uint32_t>(m_nodes.size());
+  m_nodes.push_back({ boundsMin, boundsMax, firstSegment, segmentEnd, 0 });
+  if (segmentEnd - firstSegment > SEGMENTS_PER_LEAF) {
+    uint32_t middle = firstSegment + (segmentEnd - firstSegment) / 2;
+    buildNode(firstSegment, middle);
+    uint32_t secondChild = buildNode(middle, segmentEnd);
+    m_nodes[nodeIndex].secondChild = secondChild;
+  }
+  return nodeIndex;
+}
+
+TrackProjectionIndex::SegmentHit TrackProjectionIndex::projectOnSegment(vec3 point, size_t segment) const
+{
+  vec3 p0 = m_points[segment], p1 = m_points[segment+1];
+  vec3 r = p1 - p0;
+  float squaredLength = XMVectorGetX(XMVector3LengthSq(r));
+  float fraction = squaredLength > 0 ? mathf::clamp(XMVectorGetX(XMVector3Dot(point - p0, r)) / squaredLength) : 0.f;
+  float squaredDistance = XMVectorGetX(XMVector3LengthSq(point - (p0 + r * fraction)));
+  return { segment, fraction, squaredDistance };
+}
+
+void TrackProjectionIndex::searchNeighbours(vec3 point, SegmentHit &best) const
+{
+  // walk along the track while segments get closer, the point likely only moved a few segments away
+  size_t segmentCount = m_points.size() - 1;
+  size_t start = best.segment;
+  for (size_t s = start+1; s < segmentCount; s++) {
+    SegmentHit hit = projectOnSegment(point, s);
+    if (hit.squaredDistance >= best.squaredDistance) break;
+    best = hit;
+  }
+  if (best.segment != start) return;
+  for (size_t s = start; s-- > 0; ) {
+    SegmentHit hit = projectOnSegment(point, s);
+    if (hit.squaredDistance >= best.squaredDistance) break;
+    best = hit;
+  }
+}
+
+void TrackProjectionIndex::searchHierarchy(vec3 point, SegmentHit &best) const
+{
+  auto squaredDistanceToNode = [&](const Node &node) {
+    vec3 outside = XMVectorMax(XMVectorMax(node.boundsMin - point, point - node.boundsMax), vec3{ 0,0,0,0 });
+    return XMVectorGetX(XMVector3LengthSq(outside));
+  };
+
+  // the hierarchy is balanced, its depth is the log of the number of segments
+  std::array<uint32_t, 64> stack;
+  size_t stackSize = 0;
+  stack[stackSize++] = 0;
+  while (stackSize > 0) {
+    const Node &node = m_nodes[stack[--stackSize]];
+    if (squaredDistanceToNode(node) >= best.squaredDistance)
+      continue;
+    if (node.secondChild == 0) {
+      for (size_t s = node.firstSegment; s < node.segmentEnd; s++) {
+        SegmentHit hit = projectOnSegment(point, s);
+        if (hit.squaredDistance < best.squaredDistance)
+          best = hit;
+      }
+      continue;
+    }
+    // visit the nearest child first, the farthest one is then more likely to be skipped
+    uint32_t firstChild = static_cast<uint32_t>(&node - m_nodes.data()) + 1;
+    uint32_t nearChild = firstChild, farChild = node.secondChild;
+    if (squaredDistanceToNode(m_nodes[farChild]) < squaredDistanceToNode(m_nodes[nearChild]))
+      std::swap(nearChild, farChild);
+    stack[stackSize++] = farChild;
+    stack[stackSize++] = nearChild;
+  }
+}
+
+TrackProjectionIndex::Projection TrackProjectionIndex::makeProjection(vec3 point, const SegmentHit &hit) const
+{
+  if (m_points.size() == 1)
+    return { m_points[0], {}, 0.f, 0.f, XMVectorGetX(XMVector3Length(point - m_points[0])), 0 };
+  vec3 p0 = m_points[hit.segment], p1 = m_points[hit.segment+1];
+  vec3 position = p0 + (p1 - p0) * hit.fraction;
+  vec3 forward = XMVector3Normalize(p1 - p0);
+  vec3 right = XMVector3Normalize(XMVector3Cross(m_up, forward));
+  float distance = mathf::lerp(m_distances[hit.segment], m_distances[hit.segment+1], hit.fraction);
+  float lateralOffset = XMVectorGetX(XMVector3Dot(point - position, right));
+  return { position, forward, distance, lateralOffset, std::sqrt(hit.squaredDistance), hit.segment };
+}
+
+TrackProjectionIndex::Projection TrackProjectionIndex::project(vec3 point) const
+{
+  PBL_ASSERT(!empty(), "Projection on an empty track");
+  SegmentHit best{ 0, 0.f, std::numeric_limits<float>::infinity() };
+  if (!m_nodes.empty())
+    searchHierarchy(point, best);
+  return makeProjection(point, best);
+}
+
+TrackProjectionIndex::Projection TrackProjectionIndex::project(vec3 point, size_t hintSegment) const
+{
+  if (m_nodes.empty())
+    return project(point);
+  SegmentHit best = projectOnSegment(point, std::min(hintSegment, m_points.size() - 2));
+  searchNeighbours(point, best);
+  // the point may also have moved to another part of the track, respawned...
+  searchHierarchy(point, best);
+  return makeProjection(point, best);
+}
+
+vec3 TrackProjectionIndex::sampleAtDistance(float distance) const
+{
+  if (m_points.size() == 1)
+    return m_points[0];
+  size_t segment = std::upper_bound(m_distances.begin(), m_distances.end(), distance) - m_distances.begin();
+  segment = std::clamp<size_t>(segment, 1, m_points.size() - 1) - 1;
+  float segmentLength = m_distances[segment+1] - m_distances[segment];
+  float fraction = segmentLength > 0 ? mathf::clamp((distance - m_distances[segment]) / segmentLength) : 0.f;
+  return m_points[segment] + (m_points[segment+1] - m_points[segment]) * fraction;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "./math.h"
+
+/*
+ * An index over a polyline (a discretized track, a camera rail...) to find
+ * where points are in track space: their closest point on the track, how
+ * far along the track it is and how far to the side of the track they are.
+ *
+ * Segments are grouped in a bounding volume hierarchy built over the order
+ * of the polyline, consecutive segments being close to each other. A query
+ * walks the hierarchy nearest box first and skips boxes farther than the
+ * best segment found so far, which is O(log n) on tracks that do not fold
+ * onto themselves. Callers that query points moving along the track (the
+ * player, cameras following it) pass the segment of their previous result,
+ * its neighbours are searched first so that the walk prunes almost every
+ * box right away.
+ *
+ * The index is immutable once built, const queries can run concurrently.
+ */
+class TrackProjectionIndex
+{
+public:
+  static constexpr size_t SEGMENTS_PER_LEAF = 4;
+
+  struct Projection {
+    vec3   position;        // closest point of the track
+    vec3   forward;         // normalized direction of the track at the closest point
+    float  distance;        // along the track, from its first point to the closest point
+    float  lateralOffset;   // signed, positive on the right of the track looking forward
+    float  distanceToTrack;
+    size_t segment;         // segment of the closest point, to pass to the next coherent query
+  };
+
+  TrackProjectionIndex() = default;
+  // up is used to tell the right of the track from its left, see Projection::lateralOffset
+  explicit TrackProjectionIndex(std::vector<vec3> points, vec3 up={ 0,1,0,0 });
+
+  bool empty() const { return m_points.empty(); }
+  const std::vector<vec3> &getPoints() const { return m_points; }
+  float getLength() const { return m_distances.empty() ? 0.f : m_distances.back(); }
+
+  // the index must not be empty
+  Projection project(vec3 point) const;
+  // same as project, searching around the segment of a previous projection first
+  Projection project(vec3 point, size_t hintSegment) const;
+  // the point at a distance along the track, clamped to the track
+  vec3 sampleAtDistance(float distance) const;
+
+private:
+  struct Node {
+    vec3     boundsMin;
+    vec3     boundsMax;
+    uint32_t firstSegment;
+    uint32_t segmentEnd;
+    uint32_t secondChild; // the first child immediately follows its parent, 0 for leaves
+  };
+
+  struct SegmentHit {
+    size_t segment;
+    float  fraction;        // of the segment length, 0..1
+    float  squaredDistance;
+  };
+
+  uint32_t buildNode(uint32_t firstSegment, uint32_t segmentEnd);
+  SegmentHit projectOnSegment(vec3 point, size_t segment) const;
+  void searchNeighbours(vec3 point, SegmentHit &best) const;
+  void searchHierarchy(vec3 point, SegmentHit &best) const;
+  Projection makeProjection(vec3 point, const SegmentHit &hit) const;
+
+private:
+  std::vector<vec3>  m_points;
+  std::vector<float> m_distances; // along the track up to each point
+  std::vector<Node>  m_nodes;     // depth-first, m_nodes[0] is the root
+  vec3               m_up{ 0,1,0,0 };
+};
@@ -0,0 +1,206 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <span>
+#include <stdexcept>
+#include <string>
+
+#include "flat_quad_tree.h"
+
+/*
+ * A read-only quad tree stored in a single pointer-free buffer, meant to
+ * be baked to disk and memory-mapped back (see MappedFile).
+ *
+ * The buffer holds a header followed by the cells, subregions and members
+ * arrays of a FlatQuadTree, so that a baked tree is queried in place, with
+ * the same search functors as QuadTree, without any parsing nor insertion.
+ * Values are 32 bits ids, typically indices into some array owned by the
+ * caller (the objects of a level for example), they are mapped from the
+ * FlatQuadTree's values when the tree is written.
+ *
+ * The buffer must outlive the BakedQuadTree and be aligned on 16 bytes,
+ * which mapped files and heap allocations are. Only the header is checked
+ * when a tree is opened, the content of a baked file is trusted like any
+ * other asset. The format is little-endian, as are all our targets.
+ */
+class BakedQuadTree
+{
+public:
+  using value_type = uint32_t;
+  static constexpr uint32_t MAGIC = 0x54514250; // "PBQT"
+  static constexpr uint32_t VERSION = 1;
+  static constexpr size_t SUBCELLS_COUNT = 4;
+
+  struct Header {
+    uint32_t       magic = MAGIC;
+    uint32_t       version = VERSION;
+    QuadTreeRegion spanningRegion;
+    uint32_t       cellsCount = 0;
+    uint32_t       subregionsCount = 0;
+    uint32_t       membersCount = 0;
+    uint32_t       cellsOffset = 0;      // offsets are in bytes, from the start of the buffer
+    uint32_t       subregionsOffset = 0;
+    uint32_t       membersOffset = 0;
+  };
+
+  // same layout as FlatQuadTree's cells
+  struct Cell {
+    uint32_t       memberOffset;
+    uint32_t       memberCount;
+    uint32_t       subtreeEnd;
+    uint32_t       firstSubcell;
+  };
+
+  struct Member {
+    QuadTreeRegion region;
+    value_type     id;
+  };
+
+  static_assert(std::is_trivially_copyable_v<Header> && std::is_trivially_copyable_v<Cell>
+             && std::is_trivially_copyable_v<Member> && std::is_trivially_copyable_v<QuadTreeSubregions>);
+
+  // an empty tree
+  BakedQuadTree() = default;
+
+  explicit BakedQuadTree(std::span<const std::byte> data)
+  {
+    if (data.size() < sizeof(Header) || reinterpret_cast<uintptr_t>(data.data()) % alignof(QuadTreeSubregions) != 0)
+      throw std::runtime_error("Invalid baked quad tree buffer");
+    const Header &header = *reinterpret_cast<const Header *>(data.data());
+    if (header.magic != MAGIC)
+      throw std::runtime_error("Not a baked quad tree");
+    if (header.version != VERSION)
+      throw std::runtime_error("Unsupported baked quad tree version " + std::to_string(header.version));
+    m_spanningRegion = header.spanningRegion;
+    m_cells = getArray<Cell>(data, header.cellsOffset, header.cellsCount);
+    m_subregions = getArray<QuadTreeSubregions>(data, header.subregionsOffset, header.subregionsCount);
+    m_members = getArray<Member>(data, header.membersOffset, header.membersCount);
+    if (m_cells.empty() || m_cells.size() != 1 + m_subregions.size() * SUBCELLS_COUNT)
+      throw std::runtime_error("Corrupted baked quad tree");
+  }
+
+  /*
+   * Writes a FlatQuadTree in the baked format, the tree's values are mapped
+   * to ids by idMapper. The tree can be a snapshot of a QuadTree.
+   */
+  template<class T, class TRegionMapper, float Looseness, class Policy, class IdMapper=std::identity>
+    requires std::is_invocable_r_v<value_type, IdMapper, const T &>
+  static void write(std::ostream &out, const FlatQuadTree<T, TRegionMapper, Looseness, Policy> &tree, const IdMapper &idMapper={})
+  {
+    Header header;
+    header.spanningRegion = tree.getSpanningRegion();
+    header.cellsCount = static_cast<uint32_t>(tree.m_cells.size());
+    header.subregionsCount = static_cast<uint32_t>(tree.m_subregions.size());
+    header.membersCount = static_cast<uint32_t>(tree.m_members.size());
+    header.cellsOffset = alignOffset(sizeof(Header), alignof(Cell));
+    header.subregionsOffset = alignOffset(header.cellsOffset + header.cellsCount * sizeof(Cell), alignof(QuadTreeSubregions));
+    header.membersOffset = alignOffset(header.subregionsOffset + header.subregionsCount * sizeof(QuadTreeSubregions), alignof(Member));
+
+    size_t writtenSize = 0;
+    auto writeBytes = [&](const void *bytes, size_t size, size_t offset) {
+      static constexpr char PADDING[16]{};
+      out.write(PADDING, offset - writtenSize);
+      out.write(static_cast<const char *>(bytes), size);
+      writtenSize = offset + size;
+    };
+    writeBytes(&header, sizeof(header), 0);
+    static_assert(sizeof(Cell) == sizeof(typename FlatQuadTree<T, TRegionMapper, Looseness, Policy>::FlatCell));
+    writeBytes(tree.m_cells.data(), tree.m_cells.size() * sizeof(Cell), header.cellsOffset);
+    writeBytes(tree.m_subregions.data(), tree.m_subregions.size() * sizeof(QuadTreeSubregions), header.subregionsOffset);
+    std::vector<Member> members;
+    members.reserve(tree.m_members.size());
+    for (const auto &[value, region] : tree.m_members)
+      members.push_back({ region, idMapper(value) });
+    writeBytes(members.data(), members.size() * sizeof(Member), header.membersOffset);
+    if (!out)
+      throw std::runtime_error("Could not write a baked quad tree");
+  }
+
+  const QuadTreeRegion &getSpanningRegion() const { return m_spanningRegion; }
+  size_t size() const { return m_members.size(); }
+  // members in storage order, for callers to validate the ids of a baked file
+  std::span<const Member> getMembers() const { return m_members; }
+
+  template<class Collected=value_type, class Container, class Mapper=std::identity>
+    requires std::is_invocable_r_v<Collected, Mapper, value_type>
+         and is_container_v<Container, Collected>
+  void collectInBounds(Container &container, const QuadTreeRegion &region, Mapper func={}) const
+  {
+    collectMapInShape<Collected>(container, QuadTreeRegionSearch{ region }, func);
+  }
+
+  template<class Collected, class Container, class Search, class Mapper=std::identity>
+    requires std::is_invocable_r_v<Collected, Mapper, value_type>
+         and is_container_v<Container, Collected>
+         and is_quad_tree_search_v<Search>
+  void collectMapInShape(Container &container, const Search &search, const Mapper &func={}) const
+  {
+    forEachInShape(search, [&](value_type id) { container.push_back(func(id)); });
+  }
+
+  template<class Search, class Visitor>
+    requires is_quad_tree_search_v<Search>
+         and is_quad_tree_visitor_v<Visitor, const value_type>
+  void forEachInShape(const Search &search, Visitor &&visitor) const
+  {
+    if (!m_cells.empty())
+      forEachInCell(0, search, visitor);
+  }
+
+  template<class Visitor>
+    requires is_quad_tree_visitor_v<Visitor, const value_type>
+  void forEachInBounds(const QuadTreeRegion &region, Visitor &&visitor) const
+  {
+    forEachInShape(QuadTreeRegionSearch{ region }, visitor);
+  }
+
+private:
+  static uint32_t alignOffset(size_t offset, size_t alignment)
+  {
+    size_t aligned = (offset + alignment - 1) / alignment * alignment;
+    if (aligned > UINT32_MAX)
+      throw std::runtime_error("Quad tree too large to be baked");
+    return static_cast<uint32_t>(aligned);
+  }
+
+  template<class E>
+  static std::span<const E> getArray(std::span<const std::byte> data, uint32_t offset, uint32_t count)
+  {
+    if (offset % alignof(E) != 0 || offset > data.size() || count > (data.size() - offset) / sizeof(E))
+      throw std::runtime_error("Corrupted baked quad tree");
+    return { reinterpret_cast<const E *>(data.data() + offset), count };
+  }
+
+  // returns false if the visitor stopped the query
+  template<class Search, class Visitor>
+  bool forEachInCell(uint32_t cellIndex, const Search &search, Visitor &visitor) const
+  {
+    const Cell &cell = m_cells[cellIndex];
+    for (uint32_t i = cell.memberOffset; i < cell.memberOffset + cell.memberCount; i++) {
+      auto [contains, overlaps] = search(m_members[i].region);
+      if ((contains || overlaps) && !quadtree::visit(visitor, m_members[i].id))
+        return false;
+    }
+    if (!cell.firstSubcell) return true;
+    auto [containsMask, overlapsMask] = quadtree::searchSubregions(search, m_subregions[(cell.firstSubcell-1) / SUBCELLS_COUNT]);
+    for (uint32_t i = 0; i < SUBCELLS_COUNT; i++) {
+      const Cell &subcell = m_cells[cell.firstSubcell + i];
+      if (containsMask & (1 << i)) {
+        for (uint32_t m = subcell.memberOffset; m < subcell.subtreeEnd; m++) {
+          if (!quadtree::visit(visitor, m_members[m].id)) return false;
+        }
+      } else if (overlapsMask & (1 << i)) {
+        if (!forEachInCell(cell.firstSubcell + i, search, visitor)) return false;
+      }
+    }
+    return true;
+  }
+
+private:
+  QuadTreeRegion                       m_spanningRegion{};
+  std::span<const Cell>                m_cells;      // cells[0] is the root, subcells are stored by groups of 4
+  std::span<const QuadTreeSubregions>  m_subregions; // search regions of each group of subcells
+  std::span<const Member>              m_members;    // ordered by cell, depth-first
+};
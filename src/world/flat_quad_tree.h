@@ -0,0 +1,330 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <ranges>
+#include <vector>
+
+#include "quad_tree.h"
+
+class BakedQuadTree;
+
+/*
+ * A quad tree with flat, arena-like storage.
+ *
+ * Unlike QuadTree, a FlatQuadTree cannot be modified incrementally, it is
+ * fully rebuilt from a range of objects. Members are stored in a single
+ * contiguous array ordered by cell (depth-first) so that a cell only holds
+ * an offset and a count into that array, and the members of a whole subtree
+ * are also contiguous. The rebuild is done top-down, with a counting-sort
+ * pass per cell that partitions the cell's members between itself and its
+ * subcells.
+ *
+ * Placement rules (Looseness and Policy) are the same as QuadTree's, queries
+ * have the same signatures. Like QuadTree's root, the spanning region grows
+ * to contain every member of a rebuild. References to values stored in the
+ * tree are valid until the next rebuild/clear.
+ *
+ * A FlatQuadTree can also be copied from a QuadTree, cell for cell, to get
+ * an immutable snapshot of it: const queries do not modify the tree and can
+ * run concurrently from any number of threads. See QuadTreeSnapshotBuffer.
+ * It can also be written to disk, see BakedQuadTree.
+ */
+template<class T, class TRegionMapper, float Looseness = 1.f, class Policy = QuadTreeDefaultPolicy>
+  requires std::is_invocable_r_v<QuadTreeRegion, TRegionMapper, T>
+class FlatQuadTree
+{
+public:
+  using value_type = T;
+  using policy_type = Policy;
+  static constexpr size_t MAX_MEMBER_PER_CELL = Policy::LEAF_CAPACITY;
+  static constexpr size_t SUBCELLS_COUNT = 4;
+  static constexpr size_t MAX_DEPTH = Policy::MAX_DEPTH;
+  static constexpr bool IS_LOOSE = Looseness > 1.f;
+
+private:
+  using placed_type = std::pair<value_type, QuadTreeRegion>;
+
+  struct FlatCell {
+    uint32_t       memberOffset = 0; // first member in the members array
+    uint32_t       memberCount = 0;  // number of members stored in this very cell
+    uint32_t       subtreeEnd = 0;   // one past the last member of this cell and all its subcells
+    uint32_t       firstSubcell = 0; // 0 if the cell has no subcell (the root is never a subcell)
+  };
+
+public:
+  explicit FlatQuadTree(QuadTreeRegion spanningRegion, TRegionMapper regionMapper={})
+    : m_spanningRegion(spanningRegion)
+    , m_regionMapper(std::move(regionMapper))
+  {
+    clear();
+  }
+
+  const QuadTreeRegion &getSpanningRegion() const { return m_spanningRegion; }
+  size_t size() const { return m_members.size(); }
+
+  void clear()
+  {
+    m_members.clear();
+    m_cells.clear();
+    m_cells.emplace_back();
+    m_subregions.clear();
+  }
+
+  // replaces the content of this tree by the content of a QuadTree, with the exact same cells
+  void copyFrom(const QuadTree<T, TRegionMapper, Looseness, Policy> &tree)
+  {
+    clear();
+    m_spanningRegion = tree.getSpanningRegion();
+    m_members.reserve(tree.size());
+    copyCell(0, tree.m_rootCell);
+  }
+
+  template<std::ranges::input_range Range>
+    requires std::convertible_to<std::ranges::range_reference_t<Range>, value_type>
+  void rebuild(Range &&values)
+  {
+    clear();
+    for (auto &&val : values) {
+      QuadTreeRegion valRegion = m_regionMapper(val);
+      if (!std::isfinite(valRegion.minX) || !std::isfinite(valRegion.minY) || !std::isfinite(valRegion.maxX) || !std::isfinite(valRegion.maxY))
+        throw std::runtime_error("Tried to add an item with a non-finite region to a quad tree");
+      m_members.emplace_back(val, valRegion);
+    }
+    // the tree is built from scratch, its spanning region grows to contain all members at once
+    for (const placed_type &member : m_members) {
+      m_spanningRegion.minX = std::min(m_spanningRegion.minX, member.second.minX);
+      m_spanningRegion.minY = std::min(m_spanningRegion.minY, member.second.minY);
+      m_spanningRegion.maxX = std::max(m_spanningRegion.maxX, member.second.maxX);
+      m_spanningRegion.maxY = std::max(m_spanningRegion.maxY, member.second.maxY);
+    }
+    m_sortedMembers.resize(m_members.size());
+    m_memberQuadrants.resize(m_members.size());
+    buildCell(0, m_spanningRegion, 0, static_cast<uint32_t>(m_members.size()), 0);
+  }
+
+  template<class Collected=value_type, class Container, class Mapper=std::identity>
+    requires std::is_invocable_r_v<Collected, Mapper, value_type>
+         and is_container_v<Container, Collected>
+  void collectInBounds(Container &container, const QuadTreeRegion &region, Mapper func={})
+  {
+    collectMapInShape<Collected>(container, QuadTreeRegionSearch{ region }, func);
+  }
+
+  template<class Collected=value_type, class Container, class Mapper=std::identity>
+    requires std::is_invocable_r_v<Collected, Mapper, const value_type &>
+         and is_container_v<Container, Collected>
+  void collectInBounds(Container &container, const QuadTreeRegion &region, Mapper func={}) const
+  {
+    collectMapInShape<Collected>(container, QuadTreeRegionSearch{ region }, func);
+  }
+
+  template<class Container>
+    requires is_container_v<Container, value_type*>
+  void collectRefInBounds(Container &container, const QuadTreeRegion &region)
+  {
+    return collectInBounds(container, region, [](value_type &val) { return &val; });
+  }
+
+  template<class Collected, class Container, class Search, class Mapper=std::identity>
+    requires std::is_invocable_r_v<Collected, Mapper, value_type>
+         and is_container_v<Container, Collected>
+         and is_quad_tree_search_v<Search>
+  void collectMapInShape(Container &container, const Search &search, const Mapper &func={})
+  {
+    forEachInShape(search, [&](value_type &val) { container.push_back(func(val)); });
+  }
+
+  template<class Collected, class Container, class Search, class Mapper=std::identity>
+    requires std::is_invocable_r_v<Collected, Mapper, const value_type &>
+         and is_container_v<Container, Collected>
+         and is_quad_tree_search_v<Search>
+  void collectMapInShape(Container &container, const Search &search, const Mapper &func={}) const
+  {
+    forEachInShape(search, [&](const value_type &val) { container.push_back(func(val)); });
+  }
+
+  template<class Search, class Visitor>
+    requires is_quad_tree_search_v<Search>
+         and is_quad_tree_visitor_v<Visitor, value_type>
+  void forEachInShape(const Search &search, Visitor &&visitor)
+  {
+    forEachInCell(*this, 0, search, visitor);
+  }
+
+  template<class Search, class Visitor>
+    requires is_quad_tree_search_v<Search>
+         and is_quad_tree_visitor_v<Visitor, const value_type>
+  void forEachInShape(const Search &search, Visitor &&visitor) const
+  {
+    forEachInCell(*this, 0, search, visitor);
+  }
+
+  template<class Visitor>
+    requires is_quad_tree_visitor_v<Visitor, value_type>
+  void forEachInBounds(const QuadTreeRegion &region, Visitor &&visitor)
+  {
+    forEachInCell(*this, 0, QuadTreeRegionSearch{ region }, visitor);
+  }
+
+  template<class Visitor>
+    requires is_quad_tree_visitor_v<Visitor, const value_type>
+  void forEachInBounds(const QuadTreeRegion &region, Visitor &&visitor) const
+  {
+    forEachInCell(*this, 0, QuadTreeRegionSearch{ region }, visitor);
+  }
+
+  // see QuadTree::collectBatch
+  template<class Collected=value_type, is_quad_tree_search_range_v Searches, std::ranges::random_access_range Containers, class Mapper=std::identity>
+    requires std::is_invocable_r_v<Collected, Mapper, const value_type &>
+         and is_container_v<std::ranges::range_value_t<Containers>, Collected>
+  void collectBatch(const Searches &searches, Containers &&containers, Mapper func={}) const
+  {
+    if (std::ranges::size(searches) != std::ranges::size(containers))
+      throw std::runtime_error("A batch of quad tree searches needs as many containers as searches");
+    quadtree::splitBatch(std::ranges::size(searches), [&](size_t first, const quadtree::BatchMasks &masks) {
+      auto firstContainer = std::ranges::begin(containers) + first;
+      auto visitor = [&](size_t s, const value_type &val) { firstContainer[s].push_back(func(val)); };
+      forEachInCellBatch(0, std::ranges::begin(searches) + first, masks, visitor);
+    });
+  }
+
+private:
+  friend BakedQuadTree;
+
+  void buildCell(uint32_t cellIndex, const QuadTreeRegion &cellRegion, uint32_t begin, uint32_t end, size_t depth)
+  {
+    m_cells[cellIndex].memberOffset = begin;
+    m_cells[cellIndex].memberCount = end - begin;
+    m_cells[cellIndex].subtreeEnd = end;
+    if (end - begin <= MAX_MEMBER_PER_CELL || depth >= MAX_DEPTH)
+      return;
+
+    // counting sort, bucket 0 holds the members that stay in this cell and 1..4 the subcells'
+    std::array<uint32_t, SUBCELLS_COUNT+1> bucketSizes{};
+    for (uint32_t i = begin; i < end; i++) {
+      uint8_t bucket = static_cast<uint8_t>(quadtree::selectQuadrant<Looseness>(cellRegion, m_members[i].second) + 1);
+      m_memberQuadrants[i] = bucket;
+      bucketSizes[bucket]++;
+    }
+    if (bucketSizes[0] == end - begin)
+      return;
+    if constexpr (!std::is_same_v<Policy, QuadTreeDefaultPolicy>) {
+      constexpr float subcellSideRatio = std::min((1.f + Looseness) * .25f, 1.f);
+      QuadTreeSplitCandidate candidate;
+      candidate.region = cellRegion;
+      candidate.depth = depth;
+      candidate.membersCount = end - begin;
+      candidate.stayingCount = bucketSizes[0];
+      std::copy(bucketSizes.begin() + 1, bucketSizes.end(), candidate.subcellsCounts.begin());
+      candidate.subcellAreaRatio = subcellSideRatio * subcellSideRatio;
+      if (!Policy::shouldSplit(candidate))
+        return;
+    }
+
+    std::array<uint32_t, SUBCELLS_COUNT+1> bucketOffsets;
+    bucketOffsets[0] = begin;
+    for (size_t i = 1; i <= SUBCELLS_COUNT; i++)
+      bucketOffsets[i] = bucketOffsets[i-1] + bucketSizes[i-1];
+    std::array<uint32_t, SUBCELLS_COUNT+1> bucketEnds = bucketOffsets;
+    for (uint32_t i = begin; i < end; i++)
+      m_sortedMembers[bucketEnds[m_memberQuadrants[i]]++] = std::move(m_members[i]);
+    std::move(m_sortedMembers.begin() + begin, m_sortedMembers.begin() + end, m_members.begin() + begin);
+
+    uint32_t firstSubcell = static_cast<uint32_t>(m_cells.size());
+    m_cells[cellIndex].memberCount = bucketSizes[0];
+    m_cells[cellIndex].firstSubcell = firstSubcell;
+    m_cells.resize(m_cells.size() + SUBCELLS_COUNT);
+    QuadTreeSubregions &subregions = m_subregions.emplace_back();
+    for (size_t i = 0; i < SUBCELLS_COUNT; i++) {
+      QuadTreeRegion subregion = quadtree::subregion(cellRegion, i);
+      subregions.set(i, IS_LOOSE ? subregion.scaled(Looseness) : subregion);
+    }
+    for (uint32_t i = 0; i < SUBCELLS_COUNT; i++)
+      buildCell(firstSubcell + i, quadtree::subregion(cellRegion, i), bucketOffsets[i+1], bucketOffsets[i+1] + bucketSizes[i+1], depth+1);
+  }
+
+  template<class Cell>
+  void copyCell(uint32_t cellIndex, const Cell &cell)
+  {
+    m_cells[cellIndex].memberOffset = static_cast<uint32_t>(m_members.size());
+    m_cells[cellIndex].memberCount = static_cast<uint32_t>(cell.m_members.size());
+    for (const auto &member : cell.m_members)
+      m_members.emplace_back(member.value, member.region);
+    if (cell.m_subcells) {
+      uint32_t firstSubcell = static_cast<uint32_t>(m_cells.size());
+      m_cells[cellIndex].firstSubcell = firstSubcell;
+      m_cells.resize(m_cells.size() + SUBCELLS_COUNT);
+      m_subregions.push_back(cell.m_subregions);
+      for (uint32_t i = 0; i < SUBCELLS_COUNT; i++)
+        copyCell(firstSubcell + i, cell.m_subcells[i]);
+    }
+    m_cells[cellIndex].subtreeEnd = static_cast<uint32_t>(m_members.size());
+  }
+
+  // Self is either FlatQuadTree or const FlatQuadTree, returns false if the visitor stopped the query
+  template<class Self, class Search, class Visitor>
+  static bool forEachInCell(Self &self, uint32_t cellIndex, const Search &search, Visitor &visitor)
+  {
+    const FlatCell &cell = self.m_cells[cellIndex];
+    for (uint32_t i = cell.memberOffset; i < cell.memberOffset + cell.memberCount; i++) {
+      auto [contains, overlaps] = search(self.m_members[i].second);
+      if ((contains || overlaps) && !quadtree::visit(visitor, self.m_members[i].first))
+        return false;
+    }
+    if (!cell.firstSubcell) return true;
+    auto [containsMask, overlapsMask] = quadtree::searchSubregions(search, self.m_subregions[subcellsGroup(cell)]);
+    for (uint32_t i = 0; i < SUBCELLS_COUNT; i++) {
+      uint32_t subcell = cell.firstSubcell + i;
+      if (containsMask & (1 << i)) {
+        if (!forEachInRange(self, self.m_cells[subcell].memberOffset, self.m_cells[subcell].subtreeEnd, visitor)) return false;
+      } else if (overlapsMask & (1 << i)) {
+        if (!forEachInCell(self, subcell, search, visitor)) return false;
+      }
+    }
+    return true;
+  }
+
+  template<class SearchIt, class Visitor>
+  void forEachInCellBatch(uint32_t cellIndex, SearchIt searches, const quadtree::BatchMasks &masks, Visitor &visitor) const
+  {
+    const FlatCell &cell = m_cells[cellIndex];
+    if (!masks.active) {
+      // the whole subtree is contained by the remaining searches
+      for (uint32_t i = cell.memberOffset; i < cell.subtreeEnd; i++)
+        quadtree::forEachBit(masks.contained, [&](size_t s) { visitor(s, m_members[i].first); });
+      return;
+    }
+    for (uint32_t i = cell.memberOffset; i < cell.memberOffset + cell.memberCount; i++)
+      quadtree::visitBatch(searches, masks, m_members[i].second, m_members[i].first, visitor);
+    if (!cell.firstSubcell) return;
+    std::array<quadtree::BatchMasks, SUBCELLS_COUNT> subcellsMasks = quadtree::searchSubregionsBatch(searches, masks, m_subregions[subcellsGroup(cell)]);
+    for (uint32_t i = 0; i < SUBCELLS_COUNT; i++) {
+      if (!subcellsMasks[i].empty())
+        forEachInCellBatch(cell.firstSubcell + i, searches, subcellsMasks[i], visitor);
+    }
+  }
+
+  // subcells are allocated by groups of 4 just after the root
+  static size_t subcellsGroup(const FlatCell &cell) { return (cell.firstSubcell-1) / SUBCELLS_COUNT; }
+
+  template<class Self, class Visitor>
+  static bool forEachInRange(Self &self, uint32_t begin, uint32_t end, Visitor &visitor)
+  {
+    for (uint32_t i = begin; i < end; i++) {
+      if (!quadtree::visit(visitor, self.m_members[i].first))
+        return false;
+    }
+    return true;
+  }
+
+private:
+  QuadTreeRegion            m_spanningRegion;
+  TRegionMapper             m_regionMapper;
+  std::vector<FlatCell>     m_cells;   // cells[0] is the root, subcells are stored by groups of 4
+  std::vector<QuadTreeSubregions> m_subregions; // search regions of each group of subcells
+  std::vector<placed_type>  m_members; // ordered by cell, depth-first
+  // rebuild scratch buffers, kept to avoid reallocations
+  std::vector<placed_type>  m_sortedMembers;
+  std::vector<uint8_t>      m_memberQuadrants;
+};
@@ -16,11 +16,13 @@ std::unique_ptr<WorldProp> WorldProp::makeObjectFromFile(GraphicalResourceRegist
 }
 
 std::unique_ptr<WorldProp> WorldProp::makePhysicsfullObjectFromFile(
-  GraphicalResourceRegistry &resources, const std::wstring &meshFilePath, const std::wstring &physicsMeshFilePath, const std::wstring &effectFilePath)
+  GraphicalResourceRegistry &resources, const std::wstring &meshFilePath, const std::wstring &physicsMeshFilePath, const std::wstring &effectFilePath, physx::PxTriangleMesh *physicsMesh)
 {
   std::shared_ptr<Model> model;
   std::unique_ptr<WorldProp> prop;
-  if(meshFilePath == physicsMeshFilePath) {
+  if(physicsMesh != nullptr) {
+    prop = std::make_unique<WorldProp>(resources.loadMesh(meshFilePath));
+  } else if(meshFilePath == physicsMeshFilePath) {
     auto [loadedModel, mesh] = resources.loadModelMesh(meshFilePath);
     model.swap(loadedModel);
     prop = std::make_unique<WorldProp>(mesh);
@@ -33,7 +35,10 @@ std::unique_ptr<WorldProp> WorldProp::makePhysicsfullObjectFromFile(
     std::ranges::for_each(prop->m_mesh->getSubmeshes(), [&](auto &sm) { sm.effect = effect; });
   }
   prop->m_body = pbx::PhysicsBody(prop.get());
-  physx::PxTriangleMeshGeometry meshGeometry{ makePhysicsMeshFromModel(*model) };
+  // a given mesh is shared with other props, each prop holds its own reference to it
+  if (physicsMesh != nullptr)
+    physicsMesh->acquireReference();
+  physx::PxTriangleMeshGeometry meshGeometry{ physicsMesh != nullptr ? physicsMesh : makePhysicsMeshFromModel(*model) };
   physx::PxTransform transform{ {0,0,0} };
   physx::PxMaterial *material = pbx::Physics::getSdk().createMaterial(1, 1, .2f);
   prop->m_body.addActor(PxCreateStatic(pbx::Physics::getSdk(), transform, meshGeometry, *material));
@@ -75,6 +80,11 @@ physx::PxTriangleMesh *WorldProp::makePhysicsMeshFromModel(const Model &model)
   return mesh;
 }
 
+AABB WorldProp::getWorldBoundingBox() const
+{
+  return m_mesh->getBoundingBox().getRotationIndependantBoundingBox(m_transform);
+}
+
 void WorldProp::render(RenderContext &context)
 {
   //if (!context.cameraFrustum.isOnFrustum(m_mesh->getBoundingBox().getRotationIndependantBoundingBox(m_transform)))
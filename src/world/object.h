@@ -99,11 +99,16 @@ public:
   WorldProp() = default;
 
   static std::unique_ptr<WorldProp> makeObjectFromFile(GraphicalResourceRegistry &resources, const std::wstring &meshFilePath);
-  static std::unique_ptr<WorldProp> makePhysicsfullObjectFromFile(GraphicalResourceRegistry &resources, const std::wstring &meshFilePath, const std::wstring &physicsMeshFilePath, const std::wstring &effectFilePath);
+  // the physics mesh is cooked from the physics model file if it is not given,
+  // a given mesh is referenced by the prop, the caller still releases its own reference
+  static std::unique_ptr<WorldProp> makePhysicsfullObjectFromFile(GraphicalResourceRegistry &resources, const std::wstring &meshFilePath, const std::wstring &physicsMeshFilePath, const std::wstring &effectFilePath, physx::PxTriangleMesh *physicsMesh = nullptr);
   static std::unique_ptr<WorldProp> makePhysicsfullObjectFromFile(GraphicalResourceRegistry &resources, const std::wstring &meshFilePath, const std::wstring &effectFilePath = {})
   { return makePhysicsfullObjectFromFile(resources, meshFilePath, meshFilePath, effectFilePath); }
   static physx::PxTriangleMesh *makePhysicsMeshFromModel(const Model &model);
 
+  // bounding box of the prop's mesh in world space, an approximation if the prop is rotated
+  AABB getWorldBoundingBox() const;
+
   void render(RenderContext &context) override;
   void renderShadows(RenderContext &context) override;
 
@@ -1,22 +1,48 @@
 ﻿#pragma once
 
 #include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <execution>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <numeric>
+#include <optional>
+#include <queue>
+#include <ranges>
+#include <span>
 #include <stdexcept>
 #include <vector>
 #include <concepts>
 
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define PBL_QUADTREE_SSE
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define PBL_QUADTREE_NEON
+#endif
+
 /*
  * A simple QuadTree implementation.
  *
  * Objects are stored in the quad tree, if the quad-tree must be non-owning
  * simply store pointers to your objects in the tree.
- * There is no method to remove an object from the quad tree or move an object
- * somewhere else. For game purposes fully clearing the tree and adding all
- * objects back in each frame is more than enough. You may want to have two
- * active quad trees, one for static objects that doesn't get cleared and the
- * other that gets rebuilt each frame.
+ * Each added object gets a QuadTreeHandle that can later be used to move
+ * (update) or remove it. Moving an object that stays in its cell is done in
+ * place, otherwise the object is re-inserted from the root, and cells that
+ * become sparse after a removal are merged back into their parent. For
+ * mostly-static scenes you may still want to have two active quad trees, one
+ * for static objects and one for dynamic objects.
  */
 
+struct QuadTreePoint {
+  float x{}, y{};
+};
+
 /* A quad tree region, similar to a 2D rect */
 struct QuadTreeRegion {
   float minX{}, minY{}, maxX{}, maxY{};
@@ -34,6 +60,128 @@ struct QuadTreeRegion {
     return maxX >= other.maxX && minX <= other.minX
       && maxY >= other.maxY && minY <= other.minY;
   }
+
+  // 0 if the point is inside of the region
+  constexpr float distanceSquared(const QuadTreePoint &point) const
+  {
+    float dx = std::max(std::max(minX - point.x, point.x - maxX), 0.f);
+    float dy = std::max(std::max(minY - point.y, point.y - maxY), 0.f);
+    return dx*dx + dy*dy;
+  }
+
+  // returns this region scaled around its center
+  constexpr QuadTreeRegion scaled(float factor) const
+  {
+    float centerX = (minX+maxX)*.5f, halfWidth  = (maxX-minX)*.5f*factor;
+    float centerY = (minY+maxY)*.5f, halfHeight = (maxY-minY)*.5f*factor;
+    return { centerX-halfWidth, centerY-halfHeight, centerX+halfWidth, centerY+halfHeight };
+  }
+};
+
+/*
+ * The regions of the 4 subcells of a quad tree cell, stored in SoA form so
+ * that a search can test all of them at once. See is_quad_tree_batched_search_v.
+ */
+struct QuadTreeSubregions {
+  alignas(16) float minX[4];
+  alignas(16) float minY[4];
+  alignas(16) float maxX[4];
+  alignas(16) float maxY[4];
+
+  QuadTreeRegion get(size_t i) const { return { minX[i], minY[i], maxX[i], maxY[i] }; }
+  void set(size_t i, const QuadTreeRegion &region)
+  {
+    minX[i] = region.minX; minY[i] = region.minY;
+    maxX[i] = region.maxX; maxY[i] = region.maxY;
+  }
+};
+
+/*
+ * Placement rules shared by quad tree implementations.
+ *
+ * Quadrants are indexed as follow:
+ *  2 | 3    y
+ * ---|---   ^
+ *  0 | 1    |->x
+ */
+namespace quadtree
+{
+
+constexpr QuadTreeRegion subregion(const QuadTreeRegion &region, size_t quadrant)
+{
+  float midX = (region.minX+region.maxX)*.5f;
+  float midY = (region.minY+region.maxY)*.5f;
+  return {
+    quadrant & 1 ? midX : region.minX,
+    quadrant & 2 ? midY : region.minY,
+    quadrant & 1 ? region.maxX : midX,
+    quadrant & 2 ? region.maxY : midY,
+  };
+}
+
+/*
+ * Returns the quadrant of cellRegion that a member spanning over memberRegion
+ * must be pushed down to, or -1 if the member must stay in the cell.
+ * See QuadTree for the meaning of Looseness.
+ */
+template<float Looseness>
+constexpr int selectQuadrant(const QuadTreeRegion &cellRegion, const QuadTreeRegion &memberRegion)
+{
+  float midX = (cellRegion.minX+cellRegion.maxX)*.5f;
+  float midY = (cellRegion.minY+cellRegion.maxY)*.5f;
+  if constexpr (Looseness > 1.f) {
+    float centerX = (memberRegion.minX+memberRegion.maxX)*.5f;
+    float centerY = (memberRegion.minY+memberRegion.maxY)*.5f;
+    int quadrant = (centerX < midX ? 0 : 1) + (centerY < midY ? 0 : 2);
+    return subregion(cellRegion, quadrant).scaled(Looseness).contains(memberRegion) ? quadrant : -1;
+  } else if(memberRegion.maxX < midX && memberRegion.maxY < midY) {
+    return 0;
+  } else if(memberRegion.minX >= midX && memberRegion.maxY < midY) {
+    return 1;
+  } else if(memberRegion.maxX < midX && memberRegion.minY >= midY) {
+    return 2;
+  } else if(memberRegion.minX >= midX && memberRegion.minY >= midY) {
+    return 3;
+  } else {
+    return -1;
+  }
+}
+
+/*
+ * Returns the distance along a ray at which it enters a region (0 if the
+ * origin is inside of it), or a negative value if the ray misses the region
+ * or enters it farther than maxDistance. direction must be normalized.
+ */
+constexpr float rayEntryDistance(const QuadTreeRegion &region, const QuadTreePoint &origin, const QuadTreePoint &direction, float maxDistance)
+{
+  float entry = 0.f, exit = maxDistance;
+  auto clipAxis = [&](float o, float d, float min, float max) {
+    if (d == 0.f)
+      return o >= min && o <= max;
+    float t1 = (min-o) / d, t2 = (max-o) / d;
+    entry = std::max(entry, std::min(t1, t2));
+    exit = std::min(exit, std::max(t1, t2));
+    return entry <= exit;
+  };
+  if (!clipAxis(origin.x, direction.x, region.minX, region.maxX) || !clipAxis(origin.y, direction.y, region.minY, region.maxY))
+    return -1.f;
+  return entry;
+}
+
+}
+
+/*
+ * A stable reference to an object stored in a quad tree, returned by
+ * QuadTree::add. A handle stays valid until the object is removed or
+ * the tree is cleared, handles of removed objects may be reused.
+ */
+struct QuadTreeHandle {
+  static constexpr uint32_t INVALID_INDEX = static_cast<uint32_t>(-1);
+
+  uint32_t index = INVALID_INDEX;
+
+  bool isValid() const { return index != INVALID_INDEX; }
+  constexpr bool operator==(const QuadTreeHandle &) const = default;
 };
 
 /*
@@ -52,8 +200,246 @@ struct QuadTreeRegion {
  */
 template<class T>
 constexpr bool is_quad_tree_search_v = std::is_invocable_r_v<std::pair<bool, bool>, T, const QuadTreeRegion &>;
+/*
+ * A search function may additionally accept a QuadTreeSubregions, in which
+ * case it is used to test the 4 subcells of a cell at once. It must then
+ * return a pair of 4-bit masks <C, O>, bit i of C (resp. O) being set if the
+ * search contains (resp. overlaps) subcell i. The single-region overload is
+ * still used to test individual members.
+ */
+template<class T>
+constexpr bool is_quad_tree_batched_search_v = is_quad_tree_search_v<T>
+  && std::is_invocable_r_v<std::pair<uint8_t, uint8_t>, T, const QuadTreeSubregions &>;
 template<class T, class K>
 concept is_container_v = requires(T container, K element) { { container.push_back(element) }; };
+/*
+ * A query visitor is called with each object found by a query, it may
+ * return a bool, in which case returning false stops the query.
+ */
+template<class Visitor, class T>
+concept is_quad_tree_visitor_v = std::is_invocable_v<Visitor, T &>
+  && (std::is_void_v<std::invoke_result_t<Visitor, T &>> || std::is_convertible_v<std::invoke_result_t<Visitor, T &>, bool>);
+
+/* The search function of collectInBounds, subcells are tested with a single SIMD comparison when available */
+struct QuadTreeRegionSearch {
+  QuadTreeRegion region;
+
+  std::pair<bool, bool> operator()(const QuadTreeRegion &r) const
+  {
+    bool contains = region.contains(r);
+    return { contains, contains || region.overlaps(r) };
+  }
+
+  std::pair<uint8_t, uint8_t> operator()(const QuadTreeSubregions &r) const
+  {
+#if defined(PBL_QUADTREE_SSE)
+    __m128 minX = _mm_load_ps(r.minX), minY = _mm_load_ps(r.minY);
+    __m128 maxX = _mm_load_ps(r.maxX), maxY = _mm_load_ps(r.maxY);
+    __m128 searchMinX = _mm_set1_ps(region.minX), searchMinY = _mm_set1_ps(region.minY);
+    __m128 searchMaxX = _mm_set1_ps(region.maxX), searchMaxY = _mm_set1_ps(region.maxY);
+    __m128 overlaps = _mm_and_ps(
+      _mm_and_ps(_mm_cmpge_ps(searchMaxX, minX), _mm_cmple_ps(searchMinX, maxX)),
+      _mm_and_ps(_mm_cmpge_ps(searchMaxY, minY), _mm_cmple_ps(searchMinY, maxY)));
+    __m128 contains = _mm_and_ps(
+      _mm_and_ps(_mm_cmpge_ps(searchMaxX, maxX), _mm_cmple_ps(searchMinX, minX)),
+      _mm_and_ps(_mm_cmpge_ps(searchMaxY, maxY), _mm_cmple_ps(searchMinY, minY)));
+    return { static_cast<uint8_t>(_mm_movemask_ps(contains)), static_cast<uint8_t>(_mm_movemask_ps(overlaps)) };
+#elif defined(PBL_QUADTREE_NEON)
+    float32x4_t minX = vld1q_f32(r.minX), minY = vld1q_f32(r.minY);
+    float32x4_t maxX = vld1q_f32(r.maxX), maxY = vld1q_f32(r.maxY);
+    float32x4_t searchMinX = vdupq_n_f32(region.minX), searchMinY = vdupq_n_f32(region.minY);
+    float32x4_t searchMaxX = vdupq_n_f32(region.maxX), searchMaxY = vdupq_n_f32(region.maxY);
+    uint32x4_t overlaps = vandq_u32(
+      vandq_u32(vcgeq_f32(searchMaxX, minX), vcleq_f32(searchMinX, maxX)),
+      vandq_u32(vcgeq_f32(searchMaxY, minY), vcleq_f32(searchMinY, maxY)));
+    uint32x4_t contains = vandq_u32(
+      vandq_u32(vcgeq_f32(searchMaxX, maxX), vcleq_f32(searchMinX, minX)),
+      vandq_u32(vcgeq_f32(searchMaxY, maxY), vcleq_f32(searchMinY, minY)));
+    alignas(16) static constexpr uint32_t laneBits[4] = { 1, 2, 4, 8 };
+    uint32x4_t bits = vld1q_u32(laneBits);
+    return { static_cast<uint8_t>(vaddvq_u32(vandq_u32(contains, bits))), static_cast<uint8_t>(vaddvq_u32(vandq_u32(overlaps, bits))) };
+#else
+    uint8_t containsMask = 0, overlapsMask = 0;
+    for (size_t i = 0; i < 4; i++) {
+      auto [contains, overlaps] = (*this)(r.get(i));
+      containsMask |= contains << i;
+      overlapsMask |= overlaps << i;
+    }
+    return { containsMask, overlapsMask };
+#endif
+  }
+};
+
+namespace quadtree
+{
+
+// calls a query visitor, returns false if the visitor stopped the query
+template<class Visitor, class T>
+bool visit(Visitor &visitor, T &value)
+{
+  if constexpr (std::is_void_v<std::invoke_result_t<Visitor, T &>>) {
+    visitor(value);
+    return true;
+  } else {
+    return static_cast<bool>(visitor(value));
+  }
+}
+
+// evaluates a search on the 4 subcells of a cell, see is_quad_tree_batched_search_v
+template<class Search>
+  requires is_quad_tree_search_v<Search>
+std::pair<uint8_t, uint8_t> searchSubregions(const Search &search, const QuadTreeSubregions &subregions)
+{
+  if constexpr (is_quad_tree_batched_search_v<Search>) {
+    return search(subregions);
+  } else {
+    uint8_t containsMask = 0, overlapsMask = 0;
+    for (size_t i = 0; i < 4; i++) {
+      auto [contains, overlaps] = search(subregions.get(i));
+      containsMask |= contains << i;
+      overlapsMask |= overlaps << i;
+    }
+    return { containsMask, overlapsMask };
+  }
+}
+
+// maximum number of searches done in a single traversal by collectBatch, larger batches are split
+constexpr size_t BATCH_MAX_SEARCHES = 64;
+
+/*
+ * State of a batch of searches in a cell: a bit per search of the batch,
+ * active searches must still be tested against the cell's members and
+ * subcells, contained searches already contain the whole cell.
+ */
+struct BatchMasks {
+  uint64_t active = 0;
+  uint64_t contained = 0;
+
+  bool empty() const { return (active | contained) == 0; }
+};
+
+// calls func(i) for each bit i set in mask
+template<class Func>
+void forEachBit(uint64_t mask, Func &&func)
+{
+  for (; mask; mask &= mask-1)
+    func(static_cast<size_t>(std::countr_zero(mask)));
+}
+
+// returns the masks of a batch of searches in a cell's subcells, searches is a random access iterator
+template<class SearchIt>
+std::array<BatchMasks, 4> searchSubregionsBatch(SearchIt searches, const BatchMasks &masks, const QuadTreeSubregions &subregions)
+{
+  std::array<BatchMasks, 4> subcellsMasks;
+  subcellsMasks.fill({ 0, masks.contained });
+  forEachBit(masks.active, [&](size_t s) {
+    auto [containsMask, overlapsMask] = searchSubregions(searches[s], subregions);
+    for (size_t i = 0; i < 4; i++) {
+      if (containsMask & (1 << i))
+        subcellsMasks[i].contained |= uint64_t{ 1 } << s;
+      else if (overlapsMask & (1 << i))
+        subcellsMasks[i].active |= uint64_t{ 1 } << s;
+    }
+  });
+  return subcellsMasks;
+}
+
+// visitor(s, value) is called for each search s of the batch that finds value
+template<class SearchIt, class Visitor, class T>
+void visitBatch(SearchIt searches, const BatchMasks &masks, const QuadTreeRegion &region, T &value, Visitor &visitor)
+{
+  forEachBit(masks.active, [&](size_t s) {
+    auto [contains, overlaps] = searches[s](region);
+    if (contains || overlaps)
+      visitor(s, value);
+  });
+  forEachBit(masks.contained, [&](size_t s) { visitor(s, value); });
+}
+
+// runs func(first, masks) on each chunk of at most BATCH_MAX_SEARCHES searches
+template<class Func>
+void splitBatch(size_t searchesCount, Func &&func)
+{
+  for (size_t first = 0; first < searchesCount; first += BATCH_MAX_SEARCHES) {
+    size_t count = std::min(searchesCount - first, BATCH_MAX_SEARCHES);
+    func(first, BatchMasks{ count == 64 ? ~uint64_t{ 0 } : (uint64_t{ 1 } << count) - 1, 0 });
+  }
+}
+
+}
+
+// a random access range of searches, see QuadTree::collectBatch
+template<class Searches>
+concept is_quad_tree_search_range_v = std::ranges::random_access_range<Searches>
+  && is_quad_tree_search_v<std::ranges::range_value_t<Searches>>;
+
+/* What a quad tree policy knows about a cell when deciding whether to split it */
+struct QuadTreeSplitCandidate {
+  QuadTreeRegion region;
+  size_t         depth = 0;         // 0 for the root
+  size_t         membersCount = 0;  // members of the cell if it is not split
+  size_t         stayingCount = 0;  // members that would stay in the cell if it is split (crossing its midlines)
+  std::array<size_t, 4> subcellsCounts{}; // members that would be pushed down to each subcell
+  float          subcellAreaRatio = 0; // area of a subcell's (loose) region inside of the cell, relative to the cell's area
+};
+
+/*
+ * A quad tree policy controls the shape of a tree:
+ * - LEAF_CAPACITY, a leaf holding that many members is split when another
+ *   member is added to it
+ * - MAX_DEPTH, cells at that depth are never split, even if they hold many
+ *   members (lots of objects stacked at the same spot would otherwise split
+ *   cells until floats cannot separate them)
+ * - shouldSplit, called when a leaf is over its capacity, if it refuses the
+ *   split it is asked again each time the leaf doubles in size
+ * - SUBCELLS_BUCKET_SIZE, the number of subcell sets allocated at once
+ *
+ * The default policy always splits full leaves. To tune a tree, derive
+ * from QuadTreeDefaultPolicy or QuadTreeCostPolicy and hide their members.
+ */
+struct QuadTreeDefaultPolicy {
+  static constexpr size_t LEAF_CAPACITY = 5;
+  static constexpr size_t MAX_DEPTH = 24;
+  static constexpr size_t SUBCELLS_BUCKET_SIZE = 32;
+
+  static bool shouldSplit(const QuadTreeSplitCandidate &) { return true; }
+};
+
+/*
+ * A policy that only splits a leaf if it lowers the expected cost of a query
+ * (in the spirit of the surface area heuristic): a query reaching the cell
+ * tests all of its members, or the subcells, the members that stay in the
+ * cell and the members of the subcells it reaches, which is proportional to
+ * the subcells' area. Members crossing the cell's midlines do not benefit
+ * from a split, clusters do.
+ */
+struct QuadTreeCostPolicy : QuadTreeDefaultPolicy {
+  // cost of testing the 4 subcells of a cell, relative to testing a member
+  static constexpr float SUBCELLS_TEST_COST = 1.f;
+
+  static bool shouldSplit(const QuadTreeSplitCandidate &candidate)
+  {
+    float leafCost = static_cast<float>(candidate.membersCount);
+    float splitCost = SUBCELLS_TEST_COST + static_cast<float>(candidate.stayingCount);
+    for (size_t count : candidate.subcellsCounts)
+      splitCost += candidate.subcellAreaRatio * static_cast<float>(count);
+    return splitCost < leafCost;
+  }
+};
+
+/* The shape of a quad tree, see QuadTree::computeStats */
+struct QuadTreeStats {
+  size_t cellsCount = 0;
+  size_t membersCount = 0;
+  size_t maxDepth = 0;
+  std::vector<size_t> cellsPerDepth;   // depth histogram, cellsPerDepth[0] is 1 (the root)
+  std::vector<size_t> membersPerDepth; // number of members stored in cells of each depth
+  std::vector<size_t> leavesPerDepth;
+};
+
+template<class T, class TRegionMapper, float Looseness, class Policy>
+  requires std::is_invocable_r_v<QuadTreeRegion, TRegionMapper, T>
+class FlatQuadTree;
 
 /*
  * A Quad Tree of elements of type T.
@@ -61,124 +447,380 @@ concept is_container_v = requires(T container, K element) { { container.push_bac
  * A TRegionMapper must be provided, it will be used at each insertion to
  * compute the region that the added object spans.
  *
- * The quad tree spans over a region that must be provided uppon creation,
- * there is no way of resizing or moving that region.
+ * The quad tree spans over a region that must be provided uppon creation.
+ * When an object outside of that region is added the tree grows: the root
+ * cell is moved down under a new root twice as large (repeatedly, until the
+ * object fits), existing cells and members are left untouched. Starting
+ * with a region tight around the expected content is thus better than
+ * oversizing it. The spanning region is kept by clear().
  *
  * To search in a quad tree, use one of the collectXX methods, most take
  * a "Mapper" argument that can be used to map contained objects to another
- * type (like collecting pointers instead of copies). For complex quad tree
- * queries, see is_quad_tree_search_v.
+ * type (like collecting pointers instead of copies). To avoid collecting
+ * objects at all use forEachXX or iterate over searchXX ranges. For complex
+ * quad tree queries, see is_quad_tree_search_v.
+ *
+ * By default objects are only pushed down the tree if they fit strictly
+ * inside of a subcell, objects crossing a cell's midlines stay in that cell.
+ * With a Looseness factor greater than 1 the tree becomes a "loose" quad tree,
+ * each cell accepts objects which center is inside of it and that fit in the
+ * cell's region scaled by the looseness factor (2 is a good default). Cells
+ * overlap each other but elongated or straddling objects no longer collect
+ * near the root. See LooseQuadTree.
+ *
+ * When cells are split, and how deep the tree can go, is decided by a Policy,
+ * see QuadTreeDefaultPolicy.
  */
-template<class T, class TRegionMapper>
+template<class T, class TRegionMapper, float Looseness = 1.f, class Policy = QuadTreeDefaultPolicy>
   requires std::is_invocable_r_v<QuadTreeRegion, TRegionMapper, T>
 class QuadTree
 {
+  static_assert(Looseness >= 1.f, "A quad tree's cells cannot be smaller than their region");
+  static_assert(Policy::LEAF_CAPACITY > 0 && Policy::SUBCELLS_BUCKET_SIZE > 0);
 public:
   using value_type = T;
-  static constexpr size_t MAX_MEMBER_PER_CELL = 5;
+  using handle_type = QuadTreeHandle;
+  using policy_type = Policy;
+  static constexpr bool IS_LOOSE = Looseness > 1.f;
+  static constexpr size_t MAX_MEMBER_PER_CELL = Policy::LEAF_CAPACITY;
+  static constexpr size_t MAX_DEPTH = Policy::MAX_DEPTH;
   static constexpr size_t SUBCELLS_COUNT = 4;
-  static constexpr size_t SUBCELLS_BUCKET_SIZE = 32;
+  static constexpr size_t SUBCELLS_BUCKET_SIZE = Policy::SUBCELLS_BUCKET_SIZE;
+
+  struct RaycastHit {
+    value_type *value = nullptr;
+    handle_type handle;
+    float       distance = 0; // distance from the ray origin to the point where it enters the object's region
+  };
 
 private:
-  using placed_type = std::pair<value_type, QuadTreeRegion>;
-  using subcells_index = uint16_t;
+  struct placed_type {
+    value_type     value;
+    QuadTreeRegion region;
+    handle_type    handle;
+  };
 
   struct QuadTreeCell {
   public:
-    void setRegion(const QuadTreeRegion &region) { m_region = region; }
+    void setRegion(const QuadTreeRegion &region)
+    {
+      m_region = region;
+      m_looseRegion = IS_LOOSE ? region.scaled(Looseness) : region;
+    }
     const QuadTreeRegion &getRegion() const { return m_region; }
+    // the region that all members of this cell and its subcells fit in, larger than the cell's region in loose trees
+    const QuadTreeRegion &getLooseRegion() const { return m_looseRegion; }
 
     void reset()
     {
       m_members.clear();
       m_subcells = nullptr;
+      m_parent = nullptr;
+      m_subtreeSize = 0;
     }
 
     void addMember(QuadTree &tree, placed_type &&member)
     {
-      if (!m_subcells && m_members.size() == MAX_MEMBER_PER_CELL)
+      m_subtreeSize++;
+      if (!m_subcells && shouldSplit(member.region))
         subdivideSelf(tree);
-      if (!m_subcells || !insertInSubcells(tree, member))
-        m_members.push_back(std::move(member));
+      if (QuadTreeCell *subcell = selectSubcell(member.region))
+        subcell->addMember(tree, std::move(member));
+      else
+        pushMember(tree, std::move(member));
     }
 
-    template<class Container, class Search, class Mapper>
-    void collectInShape(Container &collected, const Search &search, const Mapper &func)
+    // removes a member without updating the subtree sizes, see QuadTree::extractMember
+    placed_type takeMember(QuadTree &tree, size_t memberIndex)
     {
-      for(auto &[val, reg] : m_members)
-      {
-        auto [contains, overlaps] = search(reg);
-        if (contains || overlaps)
-          collected.push_back(func(val));
+      placed_type member = std::move(m_members[memberIndex]);
+      if (memberIndex != m_members.size()-1) {
+        m_members[memberIndex] = std::move(m_members.back());
+        tree.m_handles[m_members[memberIndex].handle.index].memberIndex = static_cast<uint32_t>(memberIndex);
       }
-      visitIntersectedSubcells(search,
-        [&](QuadTreeCell &cell) { cell.collectInShape(collected, search, func); },
-        [&](QuadTreeCell &cell) { cell.collectAll(collected, func); });
+      m_members.pop_back();
+      return member;
     }
 
-    template<class Container, class Mapper>
-    void collectAll(Container &collected, const Mapper &func) 
+    size_t getDepth() const
     {
-      std::ranges::transform(m_members, std::back_inserter(collected), func, [](placed_type &p) { return p.first; });
-      if(m_subcells) std::ranges::for_each_n(m_subcells, SUBCELLS_COUNT, [&](auto &cell) { cell.collectAll(collected, func); });
+      size_t depth = 0;
+      for (const QuadTreeCell *cell = m_parent; cell; cell = cell->m_parent)
+        depth++;
+      return depth;
     }
 
-  private:
-    template<class Search, class OverlapedVisitor, class ContainedVisitor>
-      requires is_quad_tree_search_v<Search>
-    void visitIntersectedSubcells(const Search &search, OverlapedVisitor overlapedVisitor, ContainedVisitor containedVisitor)
+    // true if this leaf must be split before a member spanning over newRegion is added to it
+    bool shouldSplit(const QuadTreeRegion &newRegion) const
+    {
+      // once refused, the split is only reconsidered each time the leaf doubles in size
+      size_t size = m_members.size();
+      if (size < MAX_MEMBER_PER_CELL || size % MAX_MEMBER_PER_CELL != 0 || !std::has_single_bit(size / MAX_MEMBER_PER_CELL))
+        return false;
+      size_t depth = getDepth();
+      if (depth >= MAX_DEPTH)
+        return false;
+      QuadTreeSplitCandidate candidate = makeSplitCandidate(m_region, depth);
+      for (const placed_type &member : m_members)
+        countSplitCandidateMember(candidate, member.region);
+      countSplitCandidateMember(candidate, newRegion);
+      return Policy::shouldSplit(candidate);
+    }
+
+    // true if a member spanning over region can stay in this cell, without going up nor down the tree
+    bool isValidPlacement(const QuadTreeRegion &region)
+    {
+      if (m_parent && !m_looseRegion.contains(region))
+        return false;
+      return selectSubcell(region) == nullptr;
+    }
+
+    // moves all members of the subcells back into this cell and releases the subcells
+    void mergeSubcells(QuadTree &tree)
     {
       if (!m_subcells) return;
+      for (size_t i = 0; i < SUBCELLS_COUNT; i++) {
+        QuadTreeCell &subcell = m_subcells[i];
+        subcell.mergeSubcells(tree);
+        for (placed_type &member : subcell.m_members)
+          pushMember(tree, std::move(member));
+        subcell.m_members.clear();
+      }
+      tree.releaseSubcellsSet(m_subcells);
+      m_subcells = nullptr;
+    }
+
+    // returns false if the visitor stopped the query
+    template<class Search, class Visitor>
+    bool forEachInShape(const Search &search, Visitor &visitor)
+    {
+      for(placed_type &member : m_members)
+      {
+        auto [contains, overlaps] = search(member.region);
+        if ((contains || overlaps) && !quadtree::visit(visitor, member.value))
+          return false;
+      }
+      if (!m_subcells) return true;
+      auto [containsMask, overlapsMask] = quadtree::searchSubregions(search, m_subregions);
       for(size_t i = 0; i < SUBCELLS_COUNT; i++) {
-        auto [contains, overlaps] = search(m_subcells[i].m_region);
-        if (contains)
-          containedVisitor(m_subcells[i]);
-        else
-          overlapedVisitor(m_subcells[i]);
+        if (containsMask & (1 << i)) {
+          if (!m_subcells[i].forEachAll(visitor)) return false;
+        } else if (overlapsMask & (1 << i)) {
+          if (!m_subcells[i].forEachInShape(search, visitor)) return false;
+        }
       }
+      return true;
     }
 
-    bool insertInSubcells(QuadTree &tree, placed_type &member)
+    // visits the members found by a batch of searches, visitor(s, value) is called for each search s finding value
+    template<class SearchIt, class Visitor>
+    void forEachInShapes(SearchIt searches, const quadtree::BatchMasks &masks, Visitor &visitor)
     {
-      QuadTreeRegion &region = member.second;
-      float midX = (m_region.minX+m_region.maxX)*.5f;
-      float midY = (m_region.minY+m_region.maxY)*.5f;
-      if(region.maxX < midX && region.maxY < midY) {
-        m_subcells[0].addMember(tree, std::move(member));
-      } else if(region.minX >= midX && region.maxY < midY) {
-        m_subcells[1].addMember(tree, std::move(member));
-      } else if(region.maxX < midX && region.minY >= midY) {
-        m_subcells[2].addMember(tree, std::move(member));
-      } else if(region.minX >= midX && region.minY >= midY) {
-        m_subcells[3].addMember(tree, std::move(member));
-      } else {
-        return false;
+      if (!masks.active) {
+        // the whole subtree is contained by the remaining searches
+        auto containedVisitor = [&](value_type &value) { quadtree::forEachBit(masks.contained, [&](size_t s) { visitor(s, value); }); };
+        forEachAll(containedVisitor);
+        return;
+      }
+      for (placed_type &member : m_members)
+        quadtree::visitBatch(searches, masks, member.region, member.value, visitor);
+      if (!m_subcells) return;
+      std::array<quadtree::BatchMasks, SUBCELLS_COUNT> subcellsMasks = quadtree::searchSubregionsBatch(searches, masks, m_subregions);
+      for (size_t i = 0; i < SUBCELLS_COUNT; i++) {
+        if (!subcellsMasks[i].empty() && m_subcells[i].m_subtreeSize > 0)
+          m_subcells[i].forEachInShapes(searches, subcellsMasks[i], visitor);
+      }
+    }
+
+    template<class Visitor>
+    bool forEachAll(Visitor &visitor)
+    {
+      for (placed_type &member : m_members) {
+        if (!quadtree::visit(visitor, member.value))
+          return false;
+      }
+      if (m_subcells) {
+        for (size_t i = 0; i < SUBCELLS_COUNT; i++) {
+          if (!m_subcells[i].forEachAll(visitor)) return false;
+        }
       }
       return true;
     }
 
+    // tests members then subcells front to back, subcells farther than the closest hit found so far are skipped
+    void raycast(const QuadTreePoint &origin, const QuadTreePoint &direction, RaycastHit &hit)
+    {
+      for (placed_type &member : m_members) {
+        float distance = quadtree::rayEntryDistance(member.region, origin, direction, hit.distance);
+        if (distance >= 0 && (!hit.value || distance < hit.distance))
+          hit = { &member.value, member.handle, distance };
+      }
+      if (!m_subcells) return;
+
+      std::array<std::pair<float, QuadTreeCell *>, SUBCELLS_COUNT> hitSubcells;
+      size_t hitSubcellsCount = 0;
+      for (size_t i = 0; i < SUBCELLS_COUNT; i++) {
+        if (m_subcells[i].m_subtreeSize == 0) continue;
+        float distance = quadtree::rayEntryDistance(m_subregions.get(i), origin, direction, hit.distance);
+        if (distance >= 0)
+          hitSubcells[hitSubcellsCount++] = { distance, &m_subcells[i] };
+      }
+      std::sort(hitSubcells.begin(), hitSubcells.begin() + hitSubcellsCount,
+        [](auto &s1, auto &s2) { return s1.first < s2.first; });
+      for (size_t i = 0; i < hitSubcellsCount; i++) {
+        if (hit.value && hitSubcells[i].first >= hit.distance)
+          break;
+        hitSubcells[i].second->raycast(origin, direction, hit);
+      }
+    }
+
+  private:
+    void pushMember(QuadTree &tree, placed_type &&member)
+    {
+      tree.m_handles[member.handle.index] = { this, static_cast<uint32_t>(m_members.size()) };
+      m_members.push_back(std::move(member));
+    }
+
+    QuadTreeCell *selectSubcell(const QuadTreeRegion &region)
+    {
+      if (!m_subcells) return nullptr;
+      int quadrant = quadtree::selectQuadrant<Looseness>(m_region, region);
+      return quadrant < 0 ? nullptr : &m_subcells[quadrant];
+    }
+
     void subdivideSelf(QuadTree &tree)
     {
-      m_subcells = tree.allocSubcellsSet(m_region);
-      float midX = (m_region.minX+m_region.maxX)*.5f;
-      float midY = (m_region.minY+m_region.maxY)*.5f;
-      //  2 | 3    y
-      // ---|---   ^  
-      //  0 | 1    |->x
-      m_subcells[0].m_region.maxX = midX; m_subcells[0].m_region.maxY = midY;
-      m_subcells[1].m_region.minX = midX; m_subcells[1].m_region.maxY = midY;
-      m_subcells[2].m_region.maxX = midX; m_subcells[2].m_region.minY = midY;
-      m_subcells[3].m_region.minX = midX; m_subcells[3].m_region.minY = midY;
+      m_subcells = tree.allocSubcellsSet();
+      for (size_t i = 0; i < SUBCELLS_COUNT; i++) {
+        m_subcells[i].setRegion(quadtree::subregion(m_region, i));
+        m_subcells[i].m_parent = this;
+        m_subregions.set(i, m_subcells[i].m_looseRegion);
+      }
 
-      // redistribute current items
-      std::erase_if(m_members, [&](placed_type &placed) { return insertInSubcells(tree, placed); });
+      // redistribute current items, members that stay here must have their handles re-indexed
+      std::vector<placed_type> members = std::move(m_members);
+      m_members.clear();
+      for (placed_type &member : members) {
+        if (QuadTreeCell *subcell = selectSubcell(member.region))
+          subcell->addMember(tree, std::move(member));
+        else
+          pushMember(tree, std::move(member));
+      }
     }
 
   private:
+    friend QuadTree;
+    template<class U, class UMapper, float L, class P>
+      requires std::is_invocable_r_v<QuadTreeRegion, UMapper, U>
+    friend class FlatQuadTree;
     QuadTreeRegion           m_region;
-    using placed_type = std::pair<value_type, QuadTreeRegion>;
+    QuadTreeRegion           m_looseRegion;
     std::vector<placed_type> m_members;
     QuadTreeCell            *m_subcells = nullptr;
+    QuadTreeSubregions       m_subregions; // loose regions of the subcells, if any
+    QuadTreeCell            *m_parent = nullptr;
+    size_t                   m_subtreeSize = 0; // number of members in this cell and all its subcells
+  };
+
+  struct HandleSlot {
+    QuadTreeCell *cell = nullptr;
+    uint32_t      memberIndex = 0;
+  };
+
+public:
+  /*
+   * The range returned by searchInShape. Its iterator walks the tree depth
+   * first using the cells' parent pointers instead of a stack so iterating
+   * does not allocate.
+   */
+  template<class Search>
+  class SearchRange
+  {
+  public:
+    class iterator
+    {
+    public:
+      using value_type = QuadTree::value_type;
+      using difference_type = std::ptrdiff_t;
+
+      iterator() = default;
+
+      value_type &operator*() const { return m_cell->m_members[m_memberIndex].value; }
+      iterator &operator++() { m_memberIndex++; advance(); return *this; }
+      void operator++(int) { ++*this; }
+      bool operator==(std::default_sentinel_t) const { return m_cell == nullptr; }
+
+    private:
+      friend SearchRange;
+
+      iterator(const Search *search, QuadTreeCell *rootCell)
+        : m_search(search), m_cell(rootCell)
+      {
+        advance();
+      }
+
+      // moves to the first member found by the search, starting at the current one
+      void advance()
+      {
+        while (m_cell) {
+          for (; m_memberIndex < m_cell->m_members.size(); m_memberIndex++) {
+            if (m_containedSubtree)
+              return;
+            auto [contains, overlaps] = (*m_search)(m_cell->m_members[m_memberIndex].region);
+            if (contains || overlaps)
+              return;
+          }
+          m_memberIndex = 0;
+          m_cell = nextCell(m_cell, 0);
+        }
+      }
+
+      // returns the next cell to visit in depth first order, starting at the firstSubcell-th subcell of cell
+      QuadTreeCell *nextCell(QuadTreeCell *cell, size_t firstSubcell)
+      {
+        while (true) {
+          if (cell->m_subcells) {
+            auto [containsMask, overlapsMask] = m_containedSubtree
+              ? std::pair<uint8_t, uint8_t>{ 0xf, 0xf }
+              : quadtree::searchSubregions(*m_search, cell->m_subregions);
+            for (size_t i = firstSubcell; i < SUBCELLS_COUNT; i++) {
+              QuadTreeCell *subcell = &cell->m_subcells[i];
+              if (subcell->m_subtreeSize == 0 || !((containsMask | overlapsMask) & (1 << i)))
+                continue;
+              if (!m_containedSubtree && (containsMask & (1 << i)))
+                m_containedSubtree = subcell;
+              return subcell;
+            }
+          }
+          // no subcell left, go on with the next sibling
+          if (!cell->m_parent)
+            return nullptr;
+          if (cell == m_containedSubtree)
+            m_containedSubtree = nullptr;
+          firstSubcell = cell - cell->m_parent->m_subcells + 1;
+          cell = cell->m_parent;
+        }
+      }
+
+    private:
+      const Search *m_search = nullptr;
+      QuadTreeCell *m_cell = nullptr;
+      QuadTreeCell *m_containedSubtree = nullptr; // a subtree which members are all found by the search
+      size_t        m_memberIndex = 0;
+    };
+
+    iterator begin() const { return iterator(&m_search, m_rootCell); }
+    std::default_sentinel_t end() const { return {}; }
+
+  private:
+    friend QuadTree;
+
+    SearchRange(Search search, QuadTreeCell &rootCell)
+      : m_search(std::move(search)), m_rootCell(&rootCell)
+    {}
+
+    Search        m_search;
+    QuadTreeCell *m_rootCell;
   };
 
 public:
@@ -189,7 +831,12 @@ public:
     m_rootCell.setRegion(spanningRegion);
   }
 
+  // cells and handles hold pointers to the root cell, the tree cannot be copied nor moved
+  QuadTree(const QuadTree &) = delete;
+  QuadTree &operator=(const QuadTree &) = delete;
+
   const QuadTreeRegion &getSpanningRegion() const { return m_rootCell.getRegion(); }
+  size_t size() const { return m_rootCell.m_subtreeSize; }
 
   void clear()
   {
@@ -197,33 +844,115 @@ public:
     m_lastBucket = m_cellsBuffer.empty() ? -1 : 0;
     std::ranges::for_each(m_cellsBuffer,
       [](auto &bucket) { std::ranges::for_each(*bucket, [](auto &cell) { cell.reset(); }); });
+    m_freeSubcellsSets.clear();
+    m_handles.clear();
+    m_freeHandles.clear();
     m_rootCell.reset();
   }
 
-  void add(value_type val)
+  /*
+   * Replaces the content of the tree by a set of values, the handle of
+   * values[i] is QuadTreeHandle{ i }.
+   * Regions are computed in parallel (the region mapper must be thread-safe)
+   * and values are sorted along a Morton curve so that the values of any cell
+   * are contiguous. Cells are then built from these ranges without the
+   * per-insertion subdivisions of add(). With the default policy values end
+   * up in the same cells as if they had been added one by one, other
+   * policies are given all the values of a cell at once.
+   */
+  void build(std::span<const value_type> values)
+  {
+    clear();
+
+    std::vector<BuildEntry> entries(values.size());
+    for (uint32_t i = 0; i < entries.size(); i++)
+      entries[i].index = i;
+    std::for_each(std::execution::par, entries.begin(), entries.end(), [&](BuildEntry &entry) {
+      entry.region = m_regionMapper(values[entry.index]);
+    });
+    if (!entries.empty()) {
+      QuadTreeRegion bounds = std::transform_reduce(std::execution::par, entries.begin(), entries.end(), entries[0].region,
+        [](const QuadTreeRegion &r1, const QuadTreeRegion &r2) {
+          return QuadTreeRegion{ std::min(r1.minX, r2.minX), std::min(r1.minY, r2.minY), std::max(r1.maxX, r2.maxX), std::max(r1.maxY, r2.maxY) };
+        },
+        [](const BuildEntry &e) { return e.region; });
+      growToContain(bounds);
+    }
+    std::for_each(std::execution::par, entries.begin(), entries.end(), [&](BuildEntry &entry) {
+      entry.mortonCode = computeMortonCode(entry.region);
+    });
+
+    // sorting packed (code, index) keys is much cheaper than sorting the entries themselves
+    std::vector<uint64_t> sortKeys(entries.size());
+    std::transform(std::execution::par, entries.begin(), entries.end(), sortKeys.begin(),
+      [](const BuildEntry &e) { return static_cast<uint64_t>(e.mortonCode) << 32 | e.index; });
+    std::sort(std::execution::par, sortKeys.begin(), sortKeys.end());
+    std::vector<BuildEntry> sortedEntries(entries.size());
+    std::transform(std::execution::par, sortKeys.begin(), sortKeys.end(), sortedEntries.begin(),
+      [&](uint64_t key) { return entries[static_cast<uint32_t>(key)]; });
+
+    m_handles.resize(values.size());
+    buildCell(values, sortedEntries, m_rootCell, 0);
+  }
+
+  handle_type add(value_type val)
   {
     QuadTreeRegion valRegion = m_regionMapper(val);
+    growToContain(valRegion);
+
+    handle_type handle = allocHandle();
+    m_rootCell.addMember(*this, placed_type{ std::move(val), valRegion, handle });
+    return handle;
+  }
+
+  void remove(handle_type handle)
+  {
+    extractMember(handle);
+    m_handles[handle.index] = {};
+    m_freeHandles.push_back(handle.index);
+  }
 
-    if (!valRegion.overlaps(getSpanningRegion()))
-      throw std::runtime_error("Tried to add an item outside the valid range of a quad tree");
+  /*
+   * Moves an object to a new region, if the object stays in the same cell
+   * the update is done in place, otherwise it is re-inserted from the root.
+   * The object's handle stays valid.
+   */
+  void update(handle_type handle, const QuadTreeRegion &newRegion)
+  {
+    growToContain(newRegion);
 
-    m_rootCell.addMember(*this, std::make_pair(std::move(val), valRegion));
+    HandleSlot slot = m_handles[handle.index];
+    if (slot.cell->isValidPlacement(newRegion)) {
+      slot.cell->m_members[slot.memberIndex].region = newRegion;
+      return;
+    }
+
+    placed_type member = extractMember(handle);
+    member.region = newRegion;
+    m_rootCell.addMember(*this, std::move(member));
   }
 
+  // same as update(handle, region) but uses the region mapper on the stored object
+  void update(handle_type handle)
+  {
+    update(handle, m_regionMapper(get(handle)));
+  }
+
+  value_type &get(handle_type handle) { const HandleSlot &slot = m_handles[handle.index]; return slot.cell->m_members[slot.memberIndex].value; }
+  const value_type &get(handle_type handle) const { const HandleSlot &slot = m_handles[handle.index]; return slot.cell->m_members[slot.memberIndex].value; }
+  const QuadTreeRegion &getRegion(handle_type handle) const { const HandleSlot &slot = m_handles[handle.index]; return slot.cell->m_members[slot.memberIndex].region; }
+
   template<class Collected=value_type, class Container, class Mapper=std::identity>
     requires std::is_invocable_r_v<Collected, Mapper, value_type>
          and is_container_v<Container, Collected>
   void collectInBounds(Container &container, const QuadTreeRegion &region, Mapper func={})
   {
-    m_rootCell.collectInShape(container, [&](const QuadTreeRegion &r) -> std::pair<bool, bool> {
-      bool contains = region.contains(r);
-      return { contains, contains || region.overlaps(r) };
-    }, func);
+    collectMapInShape<Collected>(container, QuadTreeRegionSearch{ region }, func);
   }
 
   template<class Container>
     requires is_container_v<Container, value_type*>
-  void collectRefInBounds(Container &container, const QuadTreeRegion &region) 
+  void collectRefInBounds(Container &container, const QuadTreeRegion &region)
   {
     return collectInBounds(container, region, [](value_type &val) { return &val; });
   }
@@ -234,30 +963,408 @@ public:
          and is_quad_tree_search_v<Search>
   void collectMapInShape(Container &container, const Search &search, const Mapper &func={})
   {
-    m_rootCell.collectInShape(container, search, func);
+    forEachInShape(search, [&](value_type &val) { container.push_back(func(val)); });
+  }
+
+  /*
+   * Calls visitor with each object found by a search, without collecting
+   * them. See is_quad_tree_visitor_v to stop the search early.
+   */
+  template<class Search, class Visitor>
+    requires is_quad_tree_search_v<Search>
+         and is_quad_tree_visitor_v<Visitor, value_type>
+  void forEachInShape(const Search &search, Visitor &&visitor)
+  {
+    m_rootCell.forEachInShape(search, visitor);
+  }
+
+  template<class Visitor>
+    requires is_quad_tree_visitor_v<Visitor, value_type>
+  void forEachInBounds(const QuadTreeRegion &region, Visitor &&visitor)
+  {
+    forEachInShape(QuadTreeRegionSearch{ region }, visitor);
+  }
+
+  /*
+   * Runs several searches in a single traversal of the tree, the objects
+   * found by searches[i] are appended to containers[i]. Searches that do
+   * not reach a cell or that contain it entirely are not evaluated on its
+   * content, so overlapping searches (the views culled each frame) share
+   * most of their cell visits.
+   */
+  template<class Collected=value_type, is_quad_tree_search_range_v Searches, std::ranges::random_access_range Containers, class Mapper=std::identity>
+    requires std::is_invocable_r_v<Collected, Mapper, value_type>
+         and is_container_v<std::ranges::range_value_t<Containers>, Collected>
+  void collectBatch(const Searches &searches, Containers &&containers, Mapper func={})
+  {
+    if (std::ranges::size(searches) != std::ranges::size(containers))
+      throw std::runtime_error("A batch of quad tree searches needs as many containers as searches");
+    quadtree::splitBatch(std::ranges::size(searches), [&](size_t first, const quadtree::BatchMasks &masks) {
+      auto firstContainer = std::ranges::begin(containers) + first;
+      auto visitor = [&](size_t s, value_type &val) { firstContainer[s].push_back(func(val)); };
+      m_rootCell.forEachInShapes(std::ranges::begin(searches) + first, masks, visitor);
+    });
+  }
+
+  /*
+   * Returns a lazy range over the objects found by a search, objects are
+   * searched for while the range is iterated so stopping the iteration
+   * early skips the rest of the search. The range holds a copy of the
+   * search and must not outlive the tree, nor be used while the tree is
+   * modified.
+   */
+  template<class Search>
+    requires is_quad_tree_search_v<Search>
+  SearchRange<Search> searchInShape(Search search)
+  {
+    return SearchRange<Search>(std::move(search), m_rootCell);
+  }
+
+  SearchRange<QuadTreeRegionSearch> searchInBounds(const QuadTreeRegion &region)
+  {
+    return searchInShape(QuadTreeRegionSearch{ region });
+  }
+
+  /*
+   * Returns the first object which region is hit by a ray (or a segment if
+   * maxDistance is finite). Cells are visited front to back and the search
+   * stops as soon as no closer object can be found. The direction does not
+   * need to be normalized, distances are expressed in world units.
+   */
+  std::optional<RaycastHit> raycast(const QuadTreePoint &origin, const QuadTreePoint &direction, float maxDistance)
+  {
+    float length = std::sqrt(direction.x*direction.x + direction.y*direction.y);
+    if (length == 0.f)
+      return std::nullopt;
+    RaycastHit hit;
+    hit.distance = maxDistance;
+    m_rootCell.raycast(origin, { direction.x/length, direction.y/length }, hit);
+    return hit.value ? std::make_optional(hit) : std::nullopt;
+  }
+
+  /*
+   * Collects the k objects which regions are closest to a point, in order of
+   * increasing distance (0 for regions containing the point). Cells and
+   * objects are visited best-first, only the cells that may contain one of
+   * the k nearest objects are opened.
+   */
+  template<class Collected=value_type, class Container, class Mapper=std::identity>
+    requires std::is_invocable_r_v<Collected, Mapper, value_type>
+         and is_container_v<Container, Collected>
+  void nearest(Container &container, const QuadTreePoint &point, size_t k, Mapper func={})
+  {
+    struct Candidate {
+      float         distanceSquared;
+      QuadTreeCell *cell;   // either a cell to open
+      placed_type  *member; // or a member to collect
+    };
+    auto farther = [](const Candidate &c1, const Candidate &c2) { return c1.distanceSquared > c2.distanceSquared; };
+    std::priority_queue<Candidate, std::vector<Candidate>, decltype(farther)> candidates(farther);
+
+    candidates.push({ 0.f, &m_rootCell, nullptr });
+    while (k > 0 && !candidates.empty()) {
+      Candidate candidate = candidates.top();
+      candidates.pop();
+      if (candidate.member) {
+        container.push_back(func(candidate.member->value));
+        k--;
+        continue;
+      }
+      QuadTreeCell &cell = *candidate.cell;
+      for (placed_type &member : cell.m_members)
+        candidates.push({ member.region.distanceSquared(point), nullptr, &member });
+      if (!cell.m_subcells) continue;
+      for (size_t i = 0; i < SUBCELLS_COUNT; i++) {
+        // members of a subcell are always inside of its loose region
+        if (cell.m_subcells[i].m_subtreeSize > 0)
+          candidates.push({ cell.m_subcells[i].m_looseRegion.distanceSquared(point), &cell.m_subcells[i], nullptr });
+      }
+    }
+  }
+
+  // walks the whole tree, meant for debugging and tuning policies
+  QuadTreeStats computeStats() const
+  {
+    QuadTreeStats stats;
+    std::vector<std::pair<const QuadTreeCell *, size_t>> cellsToVisit{ { &m_rootCell, 0 } };
+    while (!cellsToVisit.empty()) {
+      auto [cell, depth] = cellsToVisit.back();
+      cellsToVisit.pop_back();
+      if (stats.cellsPerDepth.size() <= depth) {
+        stats.cellsPerDepth.resize(depth+1);
+        stats.membersPerDepth.resize(depth+1);
+        stats.leavesPerDepth.resize(depth+1);
+      }
+      stats.cellsCount++;
+      stats.membersCount += cell->m_members.size();
+      stats.maxDepth = std::max(stats.maxDepth, depth);
+      stats.cellsPerDepth[depth]++;
+      stats.membersPerDepth[depth] += cell->m_members.size();
+      if (!cell->m_subcells) {
+        stats.leavesPerDepth[depth]++;
+        continue;
+      }
+      for (size_t i = 0; i < SUBCELLS_COUNT; i++)
+        cellsToVisit.emplace_back(&cell->m_subcells[i], depth+1);
+    }
+    return stats;
   }
 
 private:
   friend QuadTreeCell;
-  QuadTreeCell *allocSubcellsSet(const QuadTreeRegion &parentRegion)
+  template<class U, class UMapper, float L, class P>
+    requires std::is_invocable_r_v<QuadTreeRegion, UMapper, U>
+  friend class FlatQuadTree;
+
+  // the depth up to which build() can split ranges using morton codes, deeper cells are filled using add()
+  static constexpr size_t MORTON_DEPTH = 16;
+
+  struct BuildEntry {
+    uint32_t       mortonCode;
+    uint32_t       index;
+    QuadTreeRegion region;
+  };
+
+  placed_type makeBuiltMember(std::span<const value_type> values, const BuildEntry &entry) const
+  {
+    return placed_type{ values[entry.index], entry.region, handle_type{ entry.index } };
+  }
+
+  uint32_t computeMortonCode(const QuadTreeRegion &region) const
+  {
+    constexpr float gridSize = static_cast<float>(1 << MORTON_DEPTH);
+    const QuadTreeRegion &spanningRegion = getSpanningRegion();
+    auto quantize = [&](float x, float min, float max) {
+      return static_cast<uint32_t>(std::clamp((x-min) / (max-min) * gridSize, 0.f, gridSize-1.f));
+    };
+    // spreads the 16 low bits of x on even bits
+    auto spreadBits = [](uint32_t x) {
+      x = (x | (x << 8)) & 0x00ff00ff;
+      x = (x | (x << 4)) & 0x0f0f0f0f;
+      x = (x | (x << 2)) & 0x33333333;
+      x = (x | (x << 1)) & 0x55555555;
+      return x;
+    };
+    uint32_t x = quantize((region.minX+region.maxX)*.5f, spanningRegion.minX, spanningRegion.maxX);
+    uint32_t y = quantize((region.minY+region.maxY)*.5f, spanningRegion.minY, spanningRegion.maxY);
+    // y bits are more significant, the 2 bits of each level match quadrant indices
+    return spreadBits(x) | (spreadBits(y) << 1);
+  }
+
+  // builds a cell from a range of morton-ordered entries, the range is reordered in the process
+  void buildCell(std::span<const value_type> values, std::span<BuildEntry> entries, QuadTreeCell &cell, size_t depth)
   {
-    if (m_lastBucketSize == SUBCELLS_BUCKET_SIZE) {
-      if(m_lastBucket+1 == m_cellsBuffer.size())
-        m_cellsBuffer.emplace_back(std::make_unique<std::array<QuadTreeCell, SUBCELLS_COUNT * SUBCELLS_BUCKET_SIZE>>());
-      m_lastBucketSize = 0;
-      m_lastBucket++;
+    cell.m_subtreeSize = entries.size();
+    if (entries.size() <= MAX_MEMBER_PER_CELL || depth >= MAX_DEPTH || !shouldSplitBuiltCell(entries, cell, depth)) {
+      cell.m_members.reserve(entries.size());
+      for (const BuildEntry &entry : entries)
+        cell.pushMember(*this, makeBuiltMember(values, entry));
+      return;
     }
-    QuadTreeCell *firstCell = &m_cellsBuffer[m_lastBucket]->at(SUBCELLS_COUNT * (m_lastBucketSize++));
-    for (size_t i = 0; i < SUBCELLS_COUNT; i++)
-      firstCell[i].setRegion(parentRegion);
+    if (depth == MORTON_DEPTH) {
+      cell.m_subtreeSize = 0;
+      for (const BuildEntry &entry : entries)
+        cell.addMember(*this, makeBuiltMember(values, entry));
+      return;
+    }
+
+    cell.subdivideSelf(*this);
+
+    // entries of each quadrant are contiguous, split the range on the morton code digit of this level
+    size_t shift = 2 * (MORTON_DEPTH-1-depth);
+    std::array<size_t, SUBCELLS_COUNT+1> quadrantBounds;
+    quadrantBounds[0] = 0;
+    quadrantBounds[SUBCELLS_COUNT] = entries.size();
+    for (uint32_t q = 1; q < SUBCELLS_COUNT; q++) {
+      quadrantBounds[q] = std::partition_point(entries.begin() + quadrantBounds[q-1], entries.end(),
+        [&](const BuildEntry &e) { return ((e.mortonCode >> shift) & 3) < q; }) - entries.begin();
+    }
+
+    // entries crossing a midline stay in this cell, the others are compacted at the front
+    // of their quadrant's range (keeping the morton order). Entries which quadrant does not
+    // match their quantized morton code are rare and are simply added afterward
+    std::array<size_t, SUBCELLS_COUNT> quadrantCounts{};
+    size_t misplacedBegin = m_buildMisplaced.size();
+    for (int q = 0; q < static_cast<int>(SUBCELLS_COUNT); q++) {
+      size_t kept = quadrantBounds[q];
+      for (size_t i = quadrantBounds[q]; i < quadrantBounds[q+1]; i++) {
+        int quadrant = quadtree::selectQuadrant<Looseness>(cell.m_region, entries[i].region);
+        if (quadrant == q)
+          entries[kept++] = entries[i];
+        else if (quadrant < 0)
+          cell.pushMember(*this, makeBuiltMember(values, entries[i]));
+        else
+          m_buildMisplaced.emplace_back(entries[i], quadrant);
+      }
+      quadrantCounts[q] = kept - quadrantBounds[q];
+    }
+    cell.m_subtreeSize -= m_buildMisplaced.size() - misplacedBegin;
 
+    for (size_t q = 0; q < SUBCELLS_COUNT; q++)
+      buildCell(values, entries.subspan(quadrantBounds[q], quadrantCounts[q]), cell.m_subcells[q], depth+1);
+    for (size_t i = misplacedBegin; i < m_buildMisplaced.size(); i++) {
+      auto &[entry, quadrant] = m_buildMisplaced[i];
+      cell.m_subtreeSize++;
+      cell.m_subcells[quadrant].addMember(*this, makeBuiltMember(values, entry));
+    }
+    m_buildMisplaced.resize(misplacedBegin);
+  }
+
+  bool shouldSplitBuiltCell(std::span<const BuildEntry> entries, const QuadTreeCell &cell, size_t depth) const
+  {
+    if constexpr (std::is_same_v<Policy, QuadTreeDefaultPolicy>) {
+      return true;
+    } else {
+      QuadTreeSplitCandidate candidate = makeSplitCandidate(cell.m_region, depth);
+      for (const BuildEntry &entry : entries)
+        countSplitCandidateMember(candidate, entry.region);
+      return Policy::shouldSplit(candidate);
+    }
+  }
+
+  static QuadTreeSplitCandidate makeSplitCandidate(const QuadTreeRegion &cellRegion, size_t depth)
+  {
+    // the part of a loose subcell that is inside of the cell spans over (1+looseness)/4 of the cell's width
+    constexpr float subcellSideRatio = std::min((1.f + Looseness) * .25f, 1.f);
+    QuadTreeSplitCandidate candidate;
+    candidate.region = cellRegion;
+    candidate.depth = depth;
+    candidate.subcellAreaRatio = subcellSideRatio * subcellSideRatio;
+    return candidate;
+  }
+
+  static void countSplitCandidateMember(QuadTreeSplitCandidate &candidate, const QuadTreeRegion &memberRegion)
+  {
+    int quadrant = quadtree::selectQuadrant<Looseness>(candidate.region, memberRegion);
+    candidate.membersCount++;
+    if (quadrant < 0)
+      candidate.stayingCount++;
+    else
+      candidate.subcellsCounts[quadrant]++;
+  }
+
+  QuadTreeCell *allocSubcellsSet()
+  {
+    QuadTreeCell *firstCell;
+    if (!m_freeSubcellsSets.empty()) {
+      firstCell = m_freeSubcellsSets.back();
+      m_freeSubcellsSets.pop_back();
+    } else {
+      if (m_lastBucketSize == SUBCELLS_BUCKET_SIZE) {
+        if(m_lastBucket+1 == m_cellsBuffer.size())
+          m_cellsBuffer.emplace_back(std::make_unique<std::array<QuadTreeCell, SUBCELLS_COUNT * SUBCELLS_BUCKET_SIZE>>());
+        m_lastBucketSize = 0;
+        m_lastBucket++;
+      }
+      firstCell = &m_cellsBuffer[m_lastBucket]->at(SUBCELLS_COUNT * (m_lastBucketSize++));
+    }
     return firstCell;
   }
 
+  void releaseSubcellsSet(QuadTreeCell *firstCell)
+  {
+    for (size_t i = 0; i < SUBCELLS_COUNT; i++)
+      firstCell[i].reset();
+    m_freeSubcellsSets.push_back(firstCell);
+  }
+
+  // grows the tree until its spanning region contains region, see QuadTree
+  void growToContain(const QuadTreeRegion &region)
+  {
+    if (!std::isfinite(region.minX) || !std::isfinite(region.minY) || !std::isfinite(region.maxX) || !std::isfinite(region.maxY))
+      throw std::runtime_error("Tried to add an item with a non-finite region to a quad tree");
+
+    while (!getSpanningRegion().contains(region)) {
+      QuadTreeRegion oldRegion = getSpanningRegion();
+      float width = oldRegion.maxX - oldRegion.minX, height = oldRegion.maxY - oldRegion.minY;
+      bool growLeft = region.minX < oldRegion.minX;
+      bool growDown = region.minY < oldRegion.minY;
+      QuadTreeRegion newRegion{
+        growLeft ? oldRegion.minX - width : oldRegion.minX,
+        growDown ? oldRegion.minY - height : oldRegion.minY,
+        growLeft ? oldRegion.maxX : oldRegion.maxX + width,
+        growDown ? oldRegion.maxY : oldRegion.maxY + height,
+      };
+      if (newRegion.contains(oldRegion) && oldRegion.contains(newRegion))
+        throw std::runtime_error("A quad tree with a degenerate spanning region cannot grow");
+
+      if (m_rootCell.m_subcells || !m_rootCell.m_members.empty())
+        moveRootDown(newRegion, (growLeft ? 1 : 0) + (growDown ? 2 : 0));
+      m_rootCell.setRegion(newRegion);
+    }
+  }
+
+  // moves the content of the root cell to a new subcell of the root, newRootRegion's quadrant must match the current root region
+  void moveRootDown(const QuadTreeRegion &newRootRegion, size_t quadrant)
+  {
+    QuadTreeCell *subcells = allocSubcellsSet();
+    for (size_t i = 0; i < SUBCELLS_COUNT; i++) {
+      subcells[i].setRegion(quadtree::subregion(newRootRegion, i));
+      subcells[i].m_parent = &m_rootCell;
+    }
+
+    // the old root's region is kept as is instead of being recomputed (with rounding errors) from the new root's
+    QuadTreeCell &oldRoot = subcells[quadrant];
+    oldRoot.setRegion(m_rootCell.m_region);
+    oldRoot.m_members = std::move(m_rootCell.m_members);
+    oldRoot.m_subcells = m_rootCell.m_subcells;
+    oldRoot.m_subregions = m_rootCell.m_subregions;
+    oldRoot.m_subtreeSize = m_rootCell.m_subtreeSize;
+    if (oldRoot.m_subcells) {
+      for (size_t i = 0; i < SUBCELLS_COUNT; i++)
+        oldRoot.m_subcells[i].m_parent = &oldRoot;
+    }
+    for (placed_type &member : oldRoot.m_members)
+      m_handles[member.handle.index].cell = &oldRoot;
+
+    m_rootCell.m_members.clear();
+    m_rootCell.m_subcells = subcells;
+    for (size_t i = 0; i < SUBCELLS_COUNT; i++)
+      m_rootCell.m_subregions.set(i, subcells[i].m_looseRegion);
+  }
+
+  handle_type allocHandle()
+  {
+    if (!m_freeHandles.empty()) {
+      handle_type handle{ m_freeHandles.back() };
+      m_freeHandles.pop_back();
+      return handle;
+    }
+    m_handles.emplace_back();
+    return handle_type{ static_cast<uint32_t>(m_handles.size()-1) };
+  }
+
+  // removes a member from the tree without releasing its handle, merging sparse cells on the way
+  placed_type extractMember(handle_type handle)
+  {
+    HandleSlot slot = m_handles[handle.index];
+    placed_type member = slot.cell->takeMember(*this, slot.memberIndex);
+
+    // subtree sizes grow toward the root, find the highest cell that can be collapsed
+    QuadTreeCell *mergedCell = nullptr;
+    for (QuadTreeCell *cell = slot.cell; cell; cell = cell->m_parent) {
+      cell->m_subtreeSize--;
+      if (cell->m_subcells && cell->m_subtreeSize <= MAX_MEMBER_PER_CELL)
+        mergedCell = cell;
+    }
+    if (mergedCell)
+      mergedCell->mergeSubcells(*this);
+
+    return member;
+  }
+
 private:
   TRegionMapper             m_regionMapper;
   std::vector<std::unique_ptr<std::array<QuadTreeCell, SUBCELLS_COUNT * SUBCELLS_BUCKET_SIZE>>> m_cellsBuffer;
+  std::vector<QuadTreeCell*> m_freeSubcellsSets;
   size_t                    m_lastBucketSize;
   size_t                    m_lastBucket = -1;
+  std::vector<HandleSlot>   m_handles;
+  std::vector<uint32_t>     m_freeHandles;
+  std::vector<std::pair<BuildEntry, int>> m_buildMisplaced; // build() scratch buffer
   QuadTreeCell              m_rootCell;
 };
+
+/* A quad tree which cells are twice as large as their region, see QuadTree */
+template<class T, class TRegionMapper, float Looseness = 2.f, class Policy = QuadTreeDefaultPolicy>
+using LooseQuadTree = QuadTree<T, TRegionMapper, Looseness, Policy>;
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+
+#include "flat_quad_tree.h"
+
+/*
+ * Double-buffered immutable snapshots of a QuadTree.
+ *
+ * A single thread (the one that owns and modifies the tree) publishes
+ * snapshots of the tree, typically once per frame, while any number of
+ * threads acquire the latest snapshot and query it concurrently, queries
+ * do not lock anything. A snapshot is a FlatQuadTree with the exact same cells as the
+ * tree, only its const queries may be used.
+ *
+ * Acquired snapshots stay valid as long as they are held, even after newer
+ * ones are published. Two snapshots are recycled so that publishing does
+ * not reallocate, unless a reader still holds the older one.
+ */
+template<class T, class TRegionMapper, float Looseness = 1.f, class Policy = QuadTreeDefaultPolicy>
+class QuadTreeSnapshotBuffer
+{
+public:
+  using tree_type = QuadTree<T, TRegionMapper, Looseness, Policy>;
+  using snapshot_type = FlatQuadTree<T, TRegionMapper, Looseness, Policy>;
+
+  // copies the current content of a tree into a new snapshot and makes it the latest one, not thread-safe
+  void publish(const tree_type &tree)
+  {
+    std::shared_ptr<snapshot_type> snapshot = std::move(m_backSnapshot);
+    // the back snapshot is no longer reachable by readers, if none holds it it can be reused.
+    // use_count() is a relaxed load, the fence orders the readers' last accesses before the reuse
+    if (!snapshot || snapshot.use_count() > 1)
+      snapshot = std::make_shared<snapshot_type>(tree.getSpanningRegion());
+    else
+      std::atomic_thread_fence(std::memory_order_acquire);
+    snapshot->copyFrom(tree);
+    m_backSnapshot = std::const_pointer_cast<snapshot_type>(m_frontSnapshot.exchange(std::move(snapshot)));
+  }
+
+  // returns the latest published snapshot, or nullptr if there is none yet, thread-safe
+  std::shared_ptr<const snapshot_type> acquire() const
+  {
+    return m_frontSnapshot.load();
+  }
+
+private:
+  std::atomic<std::shared_ptr<const snapshot_type>> m_frontSnapshot;
+  std::shared_ptr<snapshot_type>                    m_backSnapshot; // only accessed by the publishing thread
+};
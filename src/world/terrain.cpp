@@ -16,6 +16,12 @@ namespace pbl
 static constexpr size_t CHUNK_SIZE = 32;
 
 Terrain::Terrain(const char *filename, GraphicalResourceRegistry &resources, TerrainSettings settings)
+  : Terrain(filename, settings)
+{
+  uploadMesh(resources);
+}
+
+Terrain::Terrain(const char *filename, TerrainSettings settings)
   : m_worldWidth(settings.worldWidth)
   , m_worldHeight(settings.worldHeight)
   , m_worldZScale(settings.worldZScale)
@@ -36,16 +42,23 @@ Terrain::Terrain(const char *filename, GraphicalResourceRegistry &resources, Ter
     }
     stbi_image_free(imageData);
 
-    std::vector<BaseVertex> vertices = buildVertices(settings.uvScale);
-    std::vector<Mesh::index_t> indices = buildIndices(m_gridWidth, m_gridHeight);
-    std::vector<Mesh::SubMesh> submeshes = buildChunks(resources, m_gridWidth, m_gridHeight);
-
-    GenericBuffer vbo{ sizeof(BaseVertex)*vertices.size(), GenericBuffer::BUFFER_VERTEX, vertices.data() };
-    GenericBuffer ibo{ sizeof(Mesh::index_t)*indices.size(), GenericBuffer::BUFFER_INDEX, indices.data() };
-    m_mesh = Mesh(std::move(ibo), std::move(vbo), sizeof(BaseVertex), std::move(submeshes), AABB{/*never actually used*/});
+    m_pendingModel.vertices = buildVertices(settings.uvScale);
+    m_pendingModel.indices = buildIndices(m_gridWidth, m_gridHeight);
     updateTransform();
 }
 
+void Terrain::uploadMesh(GraphicalResourceRegistry &resources)
+{
+  std::vector<Mesh::SubMesh> submeshes = buildChunks(resources, m_gridWidth, m_gridHeight);
+
+  const std::vector<BaseVertex> &vertices = m_pendingModel.vertices;
+  const std::vector<Mesh::index_t> &indices = m_pendingModel.indices;
+  GenericBuffer vbo{ sizeof(BaseVertex)*vertices.size(), GenericBuffer::BUFFER_VERTEX, vertices.data() };
+  GenericBuffer ibo{ sizeof(Mesh::index_t)*indices.size(), GenericBuffer::BUFFER_INDEX, indices.data() };
+  m_mesh = Mesh(std::move(ibo), std::move(vbo), sizeof(BaseVertex), std::move(submeshes), AABB{/*never actually used*/});
+  m_pendingModel = {};
+}
+
 void Terrain::render(RenderContext &context)
 {
   ObjectConstantData data{};
@@ -6,6 +6,7 @@
 #include "utils/aabb.h"
 #include "object.h"
 #include "display/mesh.h"
+#include "serial/serial_fields.h"
 
 namespace pbx
 {
@@ -21,6 +22,15 @@ struct TerrainSettings {
   float worldWidth, worldHeight;
   float worldZScale;
   float uvScale;
+
+  static constexpr auto fields()
+  {
+    return std::make_tuple(
+      SerialField{ "width",   &TerrainSettings::worldWidth  },
+      SerialField{ "height",  &TerrainSettings::worldHeight },
+      SerialField{ "zscale",  &TerrainSettings::worldZScale },
+      SerialField{ "uvscale", &TerrainSettings::uvScale     });
+  }
 };
 
 class Terrain : public WorldObject
@@ -32,6 +42,10 @@ public:
 
 public:
   Terrain(const char *filename, GraphicalResourceRegistry &resources, TerrainSettings settings);
+  // only decodes the heightmap and builds the geometry, which can be done on any thread, the mesh must then be uploaded with uploadMesh
+  Terrain(const char *filename, TerrainSettings settings);
+
+  void uploadMesh(GraphicalResourceRegistry &resources);
 
   vec3  sampleNormalAt(int gx, int gy) const;
   float getHeightAt(float x, float y) const;
@@ -58,6 +72,7 @@ private:
   std::vector<Chunk> m_chunks;
   pbx::PhysicsBody   m_physicsBody;
   Mesh               m_mesh;
+  Model              m_pendingModel; // geometry built by the constructor, released once uploaded
 };
 
 }